@@ -0,0 +1,211 @@
+#pragma once
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//*********************************************************************************************************************
+// 										Bit grids
+//*********************************************************************************************************************
+//One bit per map square, for yes/no questions asked in hot loops ("is this square solid?"). Squares are stored the
+//way map[x][y] is: row x is a run of 64-bit words holding the bits for y = 0, 1, 2, ... so a whole row of a 24x24
+//map is a single word, and asking about a span of a row tests up to 64 squares at once.
+namespace bitgrid {
+	//index of the lowest set bit; w must not be 0
+	inline int lowest_bit(unsigned long long w) {
+#ifdef _MSC_VER
+		unsigned long i;
+		_BitScanForward64(&i, w);
+		return (int)i;
+#else
+		return __builtin_ctzll(w);
+#endif
+	}
+
+	//index of the highest set bit; w must not be 0
+	inline int highest_bit(unsigned long long w) {
+#ifdef _MSC_VER
+		unsigned long i;
+		_BitScanReverse64(&i, w);
+		return (int)i;
+#else
+		return 63 - __builtin_clzll(w);
+#endif
+	}
+
+	//bits lo..63 of a word
+	inline unsigned long long mask_from(int lo) {
+		return ~0ull << lo;
+	}
+
+	//bits 0..hi of a word
+	inline unsigned long long mask_to(int hi) {
+		return ~0ull >> (63 - hi);
+	}
+
+	class grid {
+	public:
+		int width = 0, height = 0; //squares in x and y
+		int stride = 0; //words per row
+
+		grid() = default;
+
+		grid(int w, int h) {
+			resize(w, h);
+		}
+
+		//all bits cleared
+		void resize(int w, int h) {
+			width = w;
+			height = h;
+			stride = (h + 63) / 64;
+			words.assign((size_t)w * stride, 0);
+		}
+
+		void clear() {
+			words.assign(words.size(), 0);
+		}
+
+		bool test(int x, int y) const {
+			return (words[(size_t)x * stride + (y >> 6)] >> (y & 63)) & 1;
+		}
+
+		void set(int x, int y, bool on) {
+			unsigned long long& w = words[(size_t)x * stride + (y >> 6)];
+			unsigned long long bit = 1ull << (y & 63);
+			w = on ? (w | bit) : (w & ~bit);
+		}
+
+		//the words of row x
+		const unsigned long long* row(int x) const {
+			return words.data() + (size_t)x * stride;
+		}
+
+		//is any square (x, y0..y1) set? y0 <= y1, both inside the grid
+		bool any(int x, int y0, int y1) const {
+			const unsigned long long* r = row(x);
+			int w0 = y0 >> 6, w1 = y1 >> 6;
+			if (w0 == w1) return (r[w0] & mask_from(y0 & 63) & mask_to(y1 & 63)) != 0;
+			if (r[w0] & mask_from(y0 & 63)) return true;
+			for (int w = w0 + 1; w < w1; w++)
+				if (r[w]) return true;
+			return (r[w1] & mask_to(y1 & 63)) != 0;
+		}
+
+		//lowest y in y0..y1 whose square (x, y) is set, or -1: how far a ray going up row x gets
+		int first(int x, int y0, int y1) const {
+			const unsigned long long* r = row(x);
+			for (int w = y0 >> 6; w <= (y1 >> 6); w++) {
+				unsigned long long bits = r[w];
+				if (w == (y0 >> 6)) bits &= mask_from(y0 & 63);
+				if (w == (y1 >> 6)) bits &= mask_to(y1 & 63);
+				if (bits) return w * 64 + lowest_bit(bits);
+			}
+			return -1;
+		}
+
+		//highest y in y0..y1 whose square (x, y) is set, or -1: the same for a ray going down
+		int last(int x, int y0, int y1) const {
+			const unsigned long long* r = row(x);
+			for (int w = y1 >> 6; w >= (y0 >> 6); w--) {
+				unsigned long long bits = r[w];
+				if (w == (y0 >> 6)) bits &= mask_from(y0 & 63);
+				if (w == (y1 >> 6)) bits &= mask_to(y1 & 63);
+				if (bits) return w * 64 + highest_bit(bits);
+			}
+			return -1;
+		}
+
+	private:
+		std::vector<unsigned long long> words;
+	};
+
+	//a grid kept twice, by rows and by columns, so spans along either axis are word tests. Line of sight uses
+	//whichever copy turns the segment into fewer, longer spans
+	class occupancy {
+	public:
+		grid by_x; //row x holds the squares (x, 0..height-1)
+		grid by_y; //row y holds the squares (0..width-1, y)
+
+		occupancy() = default;
+
+		occupancy(int w, int h) {
+			resize(w, h);
+		}
+
+		void resize(int w, int h) {
+			by_x.resize(w, h);
+			by_y.resize(h, w);
+		}
+
+		void clear() {
+			by_x.clear();
+			by_y.clear();
+		}
+
+		int width() const {
+			return by_x.width;
+		}
+
+		int height() const {
+			return by_x.height;
+		}
+
+		bool test(int x, int y) const {
+			return by_x.test(x, y);
+		}
+
+		void set(int x, int y, bool on) {
+			by_x.set(x, y, on);
+			by_y.set(y, x, on);
+		}
+
+		//true if no set square lies on the segment (x1, y1) - (x2, y2); squares with x or y below first, or outside the
+		//grid, never block. The squares are the ones a grid traversal (Amanatides-Woo) visits, set up and stepped like
+		//traverse_clear() in main.cpp, but instead of testing square by square it finds how far the segment runs along
+		//its main axis before stepping across, and tests that run with one span test.
+		bool segment_clear(double x1, double y1, double x2, double y2, int first = 0) const {
+			if (fabs(x2 - x1) <= fabs(y2 - y1)) return runs_clear(by_x, x1, y1, x2, y2, first, true); //steep: runs along y, in rows x
+			return runs_clear(by_y, y1, x1, y2, x2, first, false);
+		}
+
+	private:
+		//segment_clear() on grid g, whose rows are indexed by u and whose bits by v; v is the segment's main axis.
+		//The traversal steps along v while the next v grid line comes before the next u grid line, on ties too if v_first.
+		//Both distances are running sums, as in traverse_clear(), so ties at grid corners come out the same way
+		static bool runs_clear(const grid& g, double u1, double v1, double u2, double v2, int first, bool v_first) {
+			int u = (int)floor(u1), v = (int)floor(v1);
+			int n = abs((int)floor(u2) - u) + abs((int)floor(v2) - v); //squares left to cross, as traverse_clear() counts them
+			double du = u2 - u1, dv = v2 - v1;
+			int su = (du > 0) ? 1 : -1, sv = (dv > 0) ? 1 : -1;
+			double tdu = (du != 0) ? fabs(1.0 / du) : 1e30; //segment fraction needed to cross one whole square
+			double tdv = (dv != 0) ? fabs(1.0 / dv) : 1e30;
+			double tu = (du != 0) ? ((du > 0) ? (u + 1 - u1) : (u1 - u)) * tdu : 1e30; //segment fraction to the next u grid line
+			double tv = (dv != 0) ? ((dv > 0) ? (v + 1 - v1) : (v1 - v)) * tdv : 1e30; //...and to the next v grid line
+
+			for (;;) {
+				int start = v; //first square of the run in row u
+				while ((n > 0) && (v_first ? (tv <= tu) : (tv < tu))) { //v steps before the next u step: only additions, no tests
+					tv += tdv;
+					v += sv;
+					n--;
+				}
+				if (!span_clear(g, u, start, v, first)) return false;
+				if (n == 0) return true;
+				tu += tdu;
+				u += su;
+				n--;
+			}
+		}
+
+		//no set square (u, a..b) in g (a and b in either order), leaving out squares below first or outside the grid
+		static bool span_clear(const grid& g, int u, int a, int b, int first) {
+			if ((u < first) || (u >= g.width)) return true;
+			int lo = std::max(std::min(a, b), first), hi = std::min(std::max(a, b), g.height - 1);
+			return (lo > hi) || !g.any(u, lo, hi);
+		}
+	};
+}
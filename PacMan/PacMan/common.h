@@ -1,4 +1,22 @@
 #pragma once
 namespace settings {
 	inline bool lighting = false;
-}
\ No newline at end of file
+	inline int threads = 0; //threads used for the lightmap bake and enemy updates; 0 = all cores (-threads N)
+	inline bool bench_lights = false; //time the lightmap bake with 1-16 threads at startup (-benchlights)
+	inline int light_blur = 1; //lightmap blur radius in texels (-blur N)
+	inline bool light_cache = true; //load/save the baked lightmap in cache/ (-nocache to always bake)
+	inline int arena_ghosts = 0; //extra ghosts spawned on random floor squares (-ghosts N)
+	inline bool bench_rays = false; //compare checkray() and checkline() on all maps at startup (-benchrays)
+	inline unsigned long long seed = 0; //random seed for textures, sky and enemies; 0 = pick one at startup (-seed N)
+	inline bool bench_paths = false; //time the hierarchical pathfinder on a large synthetic map at startup (-benchpaths)
+	inline bool bench_los = false; //check and time the bit grid line of sight on all maps and a large synthetic one at startup (-benchlos)
+	inline bool lod = true; //steer distant and unseen enemies less often (-nolod for full rate everywhere)
+	inline const char* record_file = NULL; //write every tick's input to this file (-record file)
+	inline const char* replay_file = NULL; //play a recorded game back instead of reading input (-replay file)
+	inline const char* times_file = NULL; //write how long every tick took to this file, as CSV (-times file)
+	inline int headless = -1; //simulate this many ticks with no window and print timings; 0 = the whole replay (-headless N)
+	inline const char* map = NULL; //map to load instead of asking for one (-map name)
+	inline const char* load_file = NULL; //start from this saved game, made with F5 on the same map (-load file)
+	inline int views = 1; //cameras on screen: the player, then spectator views of ghosts 0, 1, ...; up to 4 (-views N)
+	inline const char* compile_map = NULL; //compile maps/<name>.pac with its lights and baked lightmap into maps/<name>.pmap and quit (-compilemap name)
+}
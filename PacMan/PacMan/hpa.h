@@ -0,0 +1,336 @@
+#pragma once
+#include <algorithm>
+#include <cstdlib>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+//*********************************************************************************************************************
+// 										Hierarchical pathfinding (HPA*)
+//*********************************************************************************************************************
+//The grid is split into square clusters. Every walkable run along the border of two neighbouring clusters becomes an
+//entrance: a pair of linked abstract nodes, one on each side (two pairs for long runs). Nodes inside a cluster are
+//linked by their in-cluster walking distance. A query links start and goal into this graph, runs A* on it and returns
+//the abstract waypoints; refine() turns one leg into single steps. Changing a square rebuilds only the borders it lies
+//on and the clusters next to them. Cells are numbered x + y * width.
+namespace hpa {
+	struct edge {
+		int to, cost;
+	};
+
+	struct node {
+		int cell; //grid square of this entrance
+		int cluster;
+		int border; //border it belongs to, -1 = free slot
+		std::vector<edge> edges;
+	};
+
+	//scratch buffers of one search
+	struct workspace {
+		std::vector<int> dist, bfs_queue; //bfs() distances and queue
+		int bx = 0, by = 0, bw = 0; //top-left corner and width of the last bfs() box
+		std::vector<edge> start_links;
+		std::vector<int> goal_dist, gscore, parent;
+		std::vector<char> closed;
+	};
+
+	class graph {
+	public:
+		int width = 0, height = 0; //grid size
+		int csize = 16; //cluster size
+		int cw = 0, ch = 0; //clusters per row/column
+		int version = 0; //changes on every build/update, for route caches
+		std::vector<unsigned char> walk; //1=walkable
+		std::vector<node> nodes;
+
+		//builds everything from scratch; walkable(x, y) tells which squares can be walked on
+		template <class F>
+		void build(int w, int h, int cluster_size, F walkable) {
+			width = w;
+			height = h;
+			csize = cluster_size;
+			cw = (w + csize - 1) / csize;
+			ch = (h + csize - 1) / csize;
+			walk.assign((size_t)w * h, 0);
+			for (int y = 0; y < h; y++)
+				for (int x = 0; x < w; x++) walk[x + (size_t)y * w] = walkable(x, y) ? 1 : 0;
+
+			nodes.clear();
+			free_nodes.clear();
+			cluster_nodes.assign((size_t)cw * ch, std::vector<int>());
+			border_nodes.assign((size_t)cw * ch * 2, std::vector<int>());
+			for (int c = 0; c < cw * ch; c++) {
+				scan_border(2 * c);
+				scan_border(2 * c + 1);
+			}
+			for (int c = 0; c < cw * ch; c++) link_cluster(c);
+			version++;
+		}
+
+		//a square became walkable/blocked (door opened/closed)
+		void set_walkable(int x, int y, bool w) {
+			if ((x < 0) || (y < 0) || (x >= width) || (y >= height) || (walk[x + (size_t)y * width] == (w ? 1 : 0))) return;
+			walk[x + (size_t)y * width] = w ? 1 : 0;
+
+			int cx = x / csize, cy = y / csize, c = cx + cy * cw;
+			int dirty[5] = { c, -1, -1, -1, -1 }; //clusters whose links need rebuilding
+			if ((x % csize == 0) && (cx > 0)) { //left border
+				rescan_border(2 * (c - 1));
+				dirty[1] = c - 1;
+			}
+			if ((x % csize == csize - 1) && (cx < cw - 1)) { //right border
+				rescan_border(2 * c);
+				dirty[2] = c + 1;
+			}
+			if ((y % csize == 0) && (cy > 0)) { //top border
+				rescan_border(2 * (c - cw) + 1);
+				dirty[3] = c - cw;
+			}
+			if ((y % csize == csize - 1) && (cy < ch - 1)) { //bottom border
+				rescan_border(2 * c + 1);
+				dirty[4] = c + cw;
+			}
+			for (int d : dirty)
+				if (d >= 0) link_cluster(d);
+			version++;
+		}
+
+		int cluster_of(int cell) const {
+			return (cell % width) / csize + (cell / width) / csize * cw;
+		}
+
+		//abstract path from start to goal (cells); waypoints get the squares to pass through, ending with goal
+		bool find_path(int start, int goal, std::vector<int>& waypoints) {
+			workspace& w = scratch();
+			waypoints.clear();
+			if (!walk[start] || !walk[goal]) return false;
+			if (start == goal) {
+				waypoints.push_back(goal);
+				return true;
+			}
+			int sc = cluster_of(start), gc = cluster_of(goal);
+			if ((sc == gc) && (cluster_distance(goal, start) >= 0)) { //direct path inside the cluster
+				waypoints.push_back(goal);
+				return true;
+			}
+
+			//link start and goal into the graph through their clusters' nodes
+			int n = (int)nodes.size(), s = n, g = n + 1; //virtual start/goal nodes
+			w.start_links.clear();
+			cluster_distance(start, -1);
+			for (int m : cluster_nodes[sc])
+				if (dist_at(nodes[m].cell) >= 0) w.start_links.push_back({ m, dist_at(nodes[m].cell) });
+			w.goal_dist.assign(n, -1);
+			bool goal_linked = false;
+			cluster_distance(goal, -1); //distances from the goal to its whole cluster
+			for (int m : cluster_nodes[gc]) {
+				w.goal_dist[m] = dist_at(nodes[m].cell);
+				if (w.goal_dist[m] >= 0) goal_linked = true;
+			}
+			if (w.start_links.empty() || !goal_linked) return false; //walled in inside its cluster
+
+			w.gscore.assign(n + 2, -1);
+			w.parent.assign(n + 2, -1);
+			w.closed.assign(n + 2, 0);
+			std::priority_queue<std::tuple<int, int, int>, std::vector<std::tuple<int, int, int>>, std::greater<std::tuple<int, int, int>>> open; //f, -g, node: ties go to the node nearest the goal
+			w.gscore[s] = 0;
+			open.push({ heuristic(start, goal), 0, s });
+			while (!open.empty()) {
+				int cur = std::get<2>(open.top());
+				open.pop();
+				if (w.closed[cur]) continue;
+				w.closed[cur] = 1;
+				if (cur == g) break;
+
+				auto relax = [&](int to, int cost) {
+					int gs = w.gscore[cur] + cost;
+					if (!w.closed[to] && ((w.gscore[to] < 0) || (gs < w.gscore[to]))) {
+						w.gscore[to] = gs;
+						w.parent[to] = cur;
+						open.push({ gs + ((to == g) ? 0 : heuristic(nodes[to].cell, goal)), -gs, to });
+					}
+				};
+				if (cur == s)
+					for (const edge& e : w.start_links) relax(e.to, e.cost);
+				else {
+					for (const edge& e : nodes[cur].edges) relax(e.to, e.cost);
+					if (w.goal_dist[cur] >= 0) relax(g, w.goal_dist[cur]);
+				}
+			}
+			if (w.parent[g] < 0) return false;
+
+			for (int cur = g; cur != s; cur = w.parent[cur]) {
+				int cell = (cur == g) ? goal : nodes[cur].cell;
+				if (waypoints.empty() || (waypoints.back() != cell)) waypoints.push_back(cell); //nodes can share a square
+			}
+			std::reverse(waypoints.begin(), waypoints.end());
+			if (waypoints.front() == start) waypoints.erase(waypoints.begin());
+			return true;
+		}
+
+		//single steps from one square to the next waypoint, searching only the clusters of the two squares
+		bool refine(int from, int to, std::vector<int>& steps) {
+			workspace& w = scratch();
+			steps.clear();
+			int x0 = std::min(from % width, to % width) / csize * csize, y0 = std::min(from / width, to / width) / csize * csize;
+			int x1 = std::min(width, (std::max(from % width, to % width) / csize + 1) * csize), y1 = std::min(height, (std::max(from / width, to / width) / csize + 1) * csize);
+			if (bfs(to, x0, y0, x1, y1, from) < 0) return false; //distances from the target, walked back from the start
+
+			for (int cur = from; cur != to;) {
+				int cx = cur % width, cy = cur / width, best = -1;
+				const int nb[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+				for (const auto& d : nb) {
+					int nx = cx + d[0], ny = cy + d[1];
+					if ((nx < x0) || (ny < y0) || (nx >= x1) || (ny >= y1)) continue;
+					int k = (nx - x0) + (ny - y0) * w.bw;
+					if ((w.dist[k] >= 0) && (w.dist[k] == w.dist[(cx - x0) + (cy - y0) * w.bw] - 1)) {
+						best = nx + ny * width;
+						break;
+					}
+				}
+				if (best < 0) return false;
+				steps.push_back(best);
+				cur = best;
+			}
+			return true;
+		}
+
+	private:
+		std::vector<std::vector<int>> cluster_nodes; //abstract nodes in every cluster
+		std::vector<std::vector<int>> border_nodes; //abstract nodes of every border: 2*cluster = right border, 2*cluster+1 = bottom border
+		std::vector<int> free_nodes; //reusable node slots
+
+		//per-thread search buffers, so several threads can run queries on the same graph at once
+		static workspace& scratch() {
+			thread_local workspace w;
+			return w;
+		}
+
+		int heuristic(int a, int b) const {
+			return abs(a % width - b % width) + abs(a / width - b / width);
+		}
+
+		//breadth-first distances from cell inside box [x0,x1) x [y0,y1) into dist (box-relative);
+		//returns the distance to stop (stopping early there), or -1 if it is not reached / stop < 0
+		int bfs(int cell, int x0, int y0, int x1, int y1, int stop) {
+			workspace& w = scratch();
+			w.bx = x0;
+			w.by = y0;
+			w.bw = x1 - x0;
+			w.dist.assign((size_t)w.bw * (y1 - y0), -1);
+			w.bfs_queue.clear();
+			w.dist[(cell % width - x0) + (cell / width - y0) * w.bw] = 0;
+			w.bfs_queue.push_back(cell);
+			for (size_t head = 0; head < w.bfs_queue.size(); head++) {
+				int cur = w.bfs_queue[head];
+				int cx = cur % width, cy = cur / width;
+				int d = w.dist[(cx - x0) + (cy - y0) * w.bw];
+				if (cur == stop) return d;
+				const int nb[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+				for (const auto& o : nb) {
+					int nx = cx + o[0], ny = cy + o[1];
+					if ((nx < x0) || (ny < y0) || (nx >= x1) || (ny >= y1) || !walk[nx + (size_t)ny * width]) continue;
+					int k = (nx - x0) + (ny - y0) * w.bw;
+					if (w.dist[k] < 0) {
+						w.dist[k] = d + 1;
+						w.bfs_queue.push_back(nx + ny * width);
+					}
+				}
+			}
+			return -1;
+		}
+
+		//walking distance between two squares inside from's cluster (-1 = unreachable); to < 0 floods the whole cluster
+		int cluster_distance(int from, int to) {
+			int c = cluster_of(from);
+			int x0 = (c % cw) * csize, y0 = (c / cw) * csize;
+			return bfs(from, x0, y0, std::min(width, x0 + csize), std::min(height, y0 + csize), to);
+		}
+
+		//distance of a cell from the last bfs(); the cell must lie inside its box
+		int dist_at(int cell) const {
+			workspace& w = scratch();
+			return w.dist[(cell % width - w.bx) + (cell / width - w.by) * w.bw];
+		}
+
+		int add_node(int cell, int border) {
+			int id;
+			if (!free_nodes.empty()) {
+				id = free_nodes.back();
+				free_nodes.pop_back();
+			}
+			else {
+				id = (int)nodes.size();
+				nodes.push_back(node());
+			}
+			nodes[id].cell = cell;
+			nodes[id].cluster = cluster_of(cell);
+			nodes[id].border = border;
+			nodes[id].edges.clear();
+			cluster_nodes[nodes[id].cluster].push_back(id);
+			border_nodes[border].push_back(id);
+			return id;
+		}
+
+		//finds the entrances of one border (2*c = between cluster c and its right neighbour, 2*c+1 = bottom neighbour)
+		void scan_border(int border) {
+			int c = border / 2, cx = c % cw, cy = c / cw;
+			bool vertical = (border % 2 == 0);
+			if (vertical ? (cx >= cw - 1) : (cy >= ch - 1)) return; //no neighbour
+
+			int length = vertical ? std::min(csize, height - cy * csize) : std::min(csize, width - cx * csize);
+			int fixed = vertical ? (cx + 1) * csize - 1 : (cy + 1) * csize - 1; //last column/row of cluster c
+			auto cell_a = [&](int i) { return vertical ? fixed + (cy * csize + i) * width : (cx * csize + i) + fixed * width; };
+			int step = vertical ? 1 : width; //from cluster c into its neighbour
+
+			for (int i = 0; i < length;) {
+				if (!walk[cell_a(i)] || !walk[cell_a(i) + step]) {
+					i++;
+					continue;
+				}
+				int run = i;
+				while ((i < length) && walk[cell_a(i)] && walk[cell_a(i) + step]) i++;
+
+				int picks[2] = { (run + i - 1) / 2, -1 }; //one entrance in the middle of a short run, both ends of a long one
+				if (i - run >= 6) {
+					picks[0] = run;
+					picks[1] = i - 1;
+				}
+				for (int p : picks)
+					if (p >= 0) {
+						int a = add_node(cell_a(p), border), b = add_node(cell_a(p) + step, border);
+						nodes[a].edges.push_back({ b, 1 });
+						nodes[b].edges.push_back({ a, 1 });
+					}
+			}
+		}
+
+		void rescan_border(int border) {
+			for (int id : border_nodes[border]) {
+				std::vector<int>& list = cluster_nodes[nodes[id].cluster];
+				list.erase(std::find(list.begin(), list.end(), id));
+				nodes[id].border = -1;
+				nodes[id].edges.clear();
+				free_nodes.push_back(id);
+			}
+			border_nodes[border].clear();
+			scan_border(border);
+		}
+
+		//rebuilds the in-cluster edges between all nodes of cluster c
+		void link_cluster(int c) {
+			std::vector<int>& list = cluster_nodes[c];
+			for (int a : list) { //keep only the link across the node's own border; other edges may point at reused slots
+				std::vector<edge>& e = nodes[a].edges;
+				e.erase(std::remove_if(e.begin(), e.end(), [&](const edge& x) { return (nodes[x.to].border != nodes[a].border) || (nodes[x.to].cluster == c); }), e.end());
+			}
+			for (size_t i = 0; i < list.size(); i++) {
+				cluster_distance(nodes[list[i]].cell, -1);
+				for (size_t j = 0; j < list.size(); j++) {
+					int d = dist_at(nodes[list[j]].cell);
+					if ((i != j) && (d >= 0)) nodes[list[i]].edges.push_back({ list[j], d });
+				}
+			}
+		}
+	};
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//*********************************************************************************************************************
+// 										Simple multi-threading helpers
+//*********************************************************************************************************************
+namespace jobs {
+	//number of hardware threads, at least 1
+	inline int hardware_threads() {
+		unsigned int n = std::thread::hardware_concurrency();
+		return n > 0 ? (int)n : 1;
+	}
+
+	//worker threads started once and kept waiting, so per-tick work does not pay for thread creation
+	class pool {
+	public:
+		pool() {
+			for (int i = 0; i < hardware_threads() - 1; i++) workers.emplace_back([this, i]() { work(i); });
+		}
+
+		~pool() {
+			{
+				std::lock_guard<std::mutex> lock(m);
+				quit = true;
+			}
+			wake.notify_all();
+			for (std::thread& t : workers) t.join();
+		}
+
+		int size() const {
+			return (int)workers.size();
+		}
+
+		//runs body on the calling thread and `helpers` workers at once, returns when all are done; not reentrant
+		void run(int helpers, const std::function<void()>& body) {
+			if (helpers > size()) helpers = size();
+			{
+				std::lock_guard<std::mutex> lock(m);
+				task = &body;
+				wanted = helpers;
+				busy = helpers;
+				batch++;
+			}
+			wake.notify_all();
+			body();
+			std::unique_lock<std::mutex> lock(m);
+			done.wait(lock, [this]() { return busy == 0; });
+			task = nullptr;
+		}
+
+	private:
+		std::vector<std::thread> workers;
+		std::mutex m;
+		std::condition_variable wake, done;
+		const std::function<void()>* task = nullptr;
+		int wanted = 0; //workers taking part in the current batch
+		int busy = 0; //of those, still running
+		int batch = 0; //increments for every run()
+		bool quit = false;
+
+		void work(int index) {
+			int seen = 0;
+			for (;;) {
+				const std::function<void()>* body;
+				{
+					std::unique_lock<std::mutex> lock(m);
+					wake.wait(lock, [&]() { return quit || (batch != seen); });
+					if (quit) return;
+					seen = batch;
+					if (index >= wanted) continue; //not needed this time
+					body = task;
+				}
+				(*body)();
+				std::lock_guard<std::mutex> lock(m);
+				if (--busy == 0) done.notify_one();
+			}
+		}
+	};
+
+	inline pool& workers() {
+		static pool p;
+		return p;
+	}
+
+	//runs fn(job) for every job in 0..count-1 using up to `threads` threads (0 = all cores; at most one per core)
+	//jobs are handed out one at a time, so uneven jobs still balance; each job runs exactly once
+	template <class F>
+	void parallel_for(int count, int threads, F fn) {
+		if (threads <= 0) threads = hardware_threads();
+		if (threads > count) threads = count;
+		if (threads <= 1) {
+			for (int job = 0; job < count; job++) fn(job);
+			return;
+		}
+
+		std::atomic<int> next(0);
+		std::function<void()> worker = [&]() {
+			for (int job = next++; job < count; job = next++) fn(job);
+		};
+		workers().run(threads - 1, worker); //calling thread works too
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <emmintrin.h>
+
+//*********************************************************************************************************************
+// 										SSE kernels for moving entities
+//*********************************************************************************************************************
+//Entities are stored as separate x/y/vx/vy float arrays, 4 lanes at a time; n must be a multiple of 4 (pad the arrays).
+//Padding lanes and free slots should have zero velocity so moving them changes nothing.
+namespace kernels {
+	//x += vx, y += vy
+	inline void move(float* x, float* y, const float* vx, const float* vy, int n) {
+		for (int i = 0; i < n; i += 4) {
+			_mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(vx + i)));
+			_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_loadu_ps(vy + i)));
+		}
+	}
+
+	//reverses vx/vy when the square `look` ticks ahead along that axis is blocked, moves, then multiplies the velocities
+	//by keep (friction). blocked is a size x size byte map indexed [x * size + y]; positions are clamped to it
+	inline void move_bounce(float* x, float* y, float* vx, float* vy, int n, const unsigned char* blocked, int size, float look, float keep) {
+		const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(size - 1.0f);
+		const __m128 ahead = _mm_set1_ps(look), friction = _mm_set1_ps(keep), sign = _mm_set1_ps(-0.0f);
+		alignas(16) int sx[4], sy[4], ax[4], ay[4], flip_x[4], flip_y[4];
+
+		for (int i = 0; i < n; i += 4) {
+			__m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+			__m128 pvx = _mm_loadu_ps(vx + i), pvy = _mm_loadu_ps(vy + i);
+
+			//current and look-ahead squares
+			_mm_store_si128((__m128i*)sx, _mm_cvttps_epi32(_mm_min_ps(hi, _mm_max_ps(lo, px))));
+			_mm_store_si128((__m128i*)sy, _mm_cvttps_epi32(_mm_min_ps(hi, _mm_max_ps(lo, py))));
+			_mm_store_si128((__m128i*)ax, _mm_cvttps_epi32(_mm_min_ps(hi, _mm_max_ps(lo, _mm_add_ps(px, _mm_mul_ps(ahead, pvx))))));
+			_mm_store_si128((__m128i*)ay, _mm_cvttps_epi32(_mm_min_ps(hi, _mm_max_ps(lo, _mm_add_ps(py, _mm_mul_ps(ahead, pvy))))));
+			for (int l = 0; l < 4; l++) { //SSE2 has no gather: look the 8 squares up one by one
+				flip_x[l] = blocked[ax[l] * size + sy[l]] ? -1 : 0;
+				flip_y[l] = blocked[sx[l] * size + ay[l]] ? -1 : 0;
+			}
+			pvx = _mm_xor_ps(pvx, _mm_and_ps(_mm_castsi128_ps(_mm_load_si128((const __m128i*)flip_x)), sign)); //flip the sign bit where blocked
+			pvy = _mm_xor_ps(pvy, _mm_and_ps(_mm_castsi128_ps(_mm_load_si128((const __m128i*)flip_y)), sign));
+
+			_mm_storeu_ps(x + i, _mm_add_ps(px, pvx));
+			_mm_storeu_ps(y + i, _mm_add_ps(py, pvy));
+			_mm_storeu_ps(vx + i, _mm_mul_ps(pvx, friction));
+			_mm_storeu_ps(vy + i, _mm_mul_ps(pvy, friction));
+		}
+	}
+}
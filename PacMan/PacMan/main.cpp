@@ -15,7 +15,31 @@
 
 #include <filesystem>
 
+#include <chrono>
+
+#include <cstring>
+
 #include <Windows.h>
+
+#include "jobs.h"
+
+#include "mapfile.h"
+
+#include "hpa.h"
+
+#include "spatial.h"
+
+#include "kernels.h"
+
+#include "rng.h"
+
+#include "replay.h"
+
+#include "snapshot.h"
+
+#include "bitgrid.h"
+
+#include "mapbin.h"
 //*********************************************************************************************************************
 // 										Basic constants
 //*********************************************************************************************************************
@@ -85,11 +109,35 @@ unsigned short int sprites2[32 * 32 * 256];
 
 //World map
 const int map_size = 24; //square map size
-int map[map_size][map_size]; //world map
-
-//pathfinding map
-int path_map[map_size][map_size];
-int numd = 0; //door number
+struct cell_t {
+    unsigned char wall; //0 = empty, 1.. = wall texture + 1, 200/201 = horizontal/vertical door, 202 = door texture block
+    unsigned char floor; //floor texture
+    unsigned char ceiling; //ceiling texture; 0 = open sky
+    unsigned char unused; //always 0; keeps cells 4 bytes with no padding so maps can be hashed and saved as bytes
+};
+cell_t map[map_size][map_size]; //world map
+bitgrid::occupancy solid(map_size, map_size); //squares that block light and movement (walls, doors that are not fully open); see update_cell_bits()
+bitgrid::grid door_bits(map_size, map_size); //squares with a door on them
+
+//pathfinding maps: breadth-first distance fields towards target squares, kept in a small LRU cache so ghosts with
+//the same target share one and a field is only rebuilt when its target moves or the map changes
+struct path_field {
+    int target[2] = { -1, -1 }; //square the field leads to
+    int version = -1; //map_version it was built for
+    unsigned int used = 0; //path_field_clock at the last lookup, for LRU eviction
+    int dist[map_size][map_size]; //map_size at the target, one less every step away, 0=unreachable
+    char flow[map_size][map_size]; //direction (0-7, 45 degree steps) to the best neighbouring square; derived from dist
+};
+const int path_fields_max = 8; //room for 4 ghost targets and 4 scatter corners
+path_field path_fields[path_fields_max];
+unsigned int path_field_clock = 0; //counts lookups
+int path_field_builds = 0; //breadth-first floods run so far
+int nearest_floor[map_size][map_size]; //closest walkable square to every square, x + y * map_size
+int nearest_floor_version = -1; //map_version nearest_floor was built for
+double flow_dirs[8][2]; //unit vectors of the 8 flow directions
+int map_version = 0; //changes whenever walls change, so anything derived from the map is rebuilt
+hpa::graph pathfinder; //hierarchical pathfinder for enemies the path field flood does not reach
+const int path_cluster = 8; //pathfinder cluster size in squares
 //global time
 int g_time;
 
@@ -116,28 +164,81 @@ struct {
 }
 player;
 
-//Structure holding enemy data
+//Structure holding enemy data, one array per field so movement runs 4 enemies at a time (kernels.h).
+//Arrays are padded to a multiple of 4 slots; removed enemies' slots are reused
 struct {
-    int enabled; //flag if enemy is on the map
-    int type; //sprite number
-    double x, y, z; //coordinates
-    double vx, vy, vz; //velocities
-    double friction = 0.1; //friction coefficient for movement; 
-    double accel = 0.01; //acceleration coefficient for movement
-    double grav = 0.01; //gravity	
+    std::vector<float> x, y; //coordinates
+    std::vector<float> vx, vy; //velocities; 0 in free slots
+    std::vector<float> hp; //hitpoints; projectiles take their damage off
+    std::vector<int> type; //sprite number
+    std::vector<char> enabled; //flag if enemy is on the map
+    std::vector<unsigned char> lod; //level of detail bucket, see move_enemies()
+    std::vector<int> seen; //g_time the player last had the enemy in sight
+    std::vector<int> free_slots; //disabled slots, reused first by spawn_enemy()
+    int count = 0; //slots in use, enabled or not
 }
-enemies[16];
+enemies;
+const float enemy_friction = 0.94f; //share of velocity kept every tick
+spatial::grid enemy_grid; //enabled enemies by position; rebuilt every time they have moved
+const double enemy_grid_cell = 0.5; //enemy_grid cell size, in map squares
+const double enemy_spacing = 0.4; //enemies closer than this push each other apart
+const double projectile_reach = 0.3; //projectiles hit enemies whose center they pass closer than this
+
+//simulation level of detail: enemies far from the player and out of his sight steer less often, with a longer time step
+const int lod_buckets = 3;
+const int lod_period[lod_buckets] = { 1, 2, 4 }; //ticks between steering updates in each bucket
+const double lod_range[lod_buckets - 1] = { 6, 12 }; //bucket 0 is closer than 6 squares, bucket 1 closer than 12 (or in sight)
+const double lod_margin = 2; //an enemy moves to a farther bucket only this far past the range, so it does not flicker
+const int lod_sight_ticks = 60; //an enemy counts as in sight for this long after it was last in view
+int lod_counts[lod_buckets]; //enabled enemies per bucket in the last move_enemies()
+
+//cached pathfinder route of an enemy; reused while the graph is unchanged and the target stays in the same cluster
+struct route_t {
+    int version = -1; //pathfinder.version the route was found with
+    int goal = -1; //target square
+    std::vector<int> waypoints; //abstract path, squares as x + y * map_size
+    int next = 0; //next waypoint
+    std::vector<int> steps; //single steps to the current waypoint
+    int step = 0; //next step
+};
+std::vector<route_t> enemy_routes; //one per enemy slot
+const int ghost_colors[4] = { 12, 13, 10, 14 }; //minimap colors of the 4 ghost types
 
 //Global flags
 int F_exit = 0; //turns to 1 when player presses esc.
 double key_delay; //for toggle on/off keys, to avoid toggling things 100 times per second
 
-// Projectiles
-double projectiles[64][8];//x,y,vx,vy,type,dmg,associated light
-int num_projectile;
-
-// Doors
-int mapanims[64][2]; //map animation data (like doors): type, frame
+// Projectiles, one array per field like enemies
+const int max_projectiles = 1024;
+struct {
+    float x[max_projectiles], y[max_projectiles]; //coordinates
+    float vx[max_projectiles], vy[max_projectiles]; //velocities; 0 in free slots
+    int type[max_projectiles]; //sprite; 0 = free slot
+    float dmg[max_projectiles]; //damage dealt to an enemy
+    int light[max_projectiles]; //associated light
+    int free_slots[max_projectiles]; //stack of free slots
+    int free_count = -1; //-1 = stack not filled yet
+}
+projectiles;
+
+//what a projectile ran into; hits are found along the whole path it flew this tick, see sweep_projectile()
+struct hit_event {
+    int projectile;
+    int enemy; //-1 = wall (or the map edge)
+    float x, y; //impact point: projectile position at first contact
+};
+std::vector<hit_event> projectile_hits; //this tick's hits, in projectile order
+
+// Doors: any number of them; only the ones moving cost anything per tick
+struct door_t {
+    int x, y; //map square
+    int dir; //1 = closing (or closed), -1 = opening (or open); the use key flips it
+    int frame; //0 = closed .. 32 = fully open
+    int moving; //1 while listed in moving_doors
+};
+std::vector<door_t> doors;
+int door_index[map_size][map_size]; //doors[] index of the door on every square, -1 = none
+std::vector<int> moving_doors; //doors between closed and open, in the order they started moving
 double player_anim[16]; //various player animations
 
 //Graphics effects
@@ -154,9 +255,24 @@ double light_flashlight; //flashlight type source
 double flashlight_coeff[res_X * res_Y]; //pre-computed brightness map (faloff from screen center) 
 double sky_light; //amount of light from open sky
 
-double lightmap[map_size * 16][map_size * 16]; //brightness map, every square divided into 16x16 sub-squares
+double lightmap_buf[map_size * 16][map_size * 16]; //brightness map, every square divided into 16x16 sub-squares
+double light_raw_buf[map_size * 16][map_size * 16]; //unblurred lightmap; kept so parts of it can be rebaked later
+double(*lightmap)[map_size * 16] = lightmap_buf; //the two above are used through these; they point into the lightmap cache file when it is loaded
+double(*light_raw)[map_size * 16] = light_raw_buf;
 double light_tmp[map_size * 16][map_size * 16]; //secondary helper buffer for lightmap
-double static_lights[64][4]; //64 lights; x,y,strength,height; for calculating lightmap
+double light_stage[map_size * 16][map_size * 16]; //staging buffer for incremental rebakes, swapped in when complete
+const int max_lights = 256; //static light slots
+double static_lights[max_lights][4]; //x,y,strength,height; for calculating lightmap
+const double light_radius = 12; //maximum reach of a static light, in squares
+char light_masks[max_lights][map_size][map_size]; //per light and map square: 0=dark, 1=partly lit (ray per texel), 2=fully lit
+
+//Incremental lightmap rebake (doors opening/closing change occlusion)
+struct {
+    int active; //1 while a rebake is in progress
+    int x0, y0, x1, y1; //lightmap region being rebaked, [x0,x1) x [y0,y1)
+    int row; //next lightmap row (x coordinate) to bake
+} light_rebake;
+const int light_rebake_rows = 16; //lightmap rows baked per frame; a whole region takes a few dozen frames
 
 //*********************************************************************************************************************
 // 										Game State
@@ -168,6 +284,27 @@ int state = 0; // 0 = menu; 1 = game;
 // 										Various helper functions
 //*********************************************************************************************************************
 
+//does the map square block light and movement? fully open doors do not
+int square_blocked(int mcx, int mcy) {
+    return solid.test(mcx, mcy);
+}
+
+//recomputes the solid and door bits of square (x, y) from its cell and door; call after either changes
+void update_cell_bits(int x, int y) {
+    int door = door_index[x][y];
+    int wall = map[x][y].wall;
+    int open = ((wall == 200) || (wall == 201)) && (doors[door].frame >= 32);
+    solid.set(x, y, (wall > 0) && !open);
+    door_bits.set(x, y, door >= 0);
+}
+
+//can the player walk into square (x, y)? a door lets them through once it is nearly open and still opening
+int player_blocked(int x, int y) {
+    if (!door_bits.test(x, y)) return solid.test(x, y);
+    const door_t& door = doors[door_index[x][y]];
+    return (map[x][y].wall == 202) || (door.dir != -1) || (door.frame <= 30);
+}
+
 //checks if there is a straight line connection between 2 points; useful for casting light rays
 int checkray(double x1, double y1, double x2, double y2, int steps) {
     double dx = (x2 - x1) / (1.0 * steps);
@@ -181,7 +318,7 @@ int checkray(double x1, double y1, double x2, double y2, int steps) {
         mcx = (int)x1;
         mcy = (int)y1;
         if ((mcx > 0) && (mcy > 0) && (mcx < map_size) && (mcy < map_size))
-            if ((map[mcx][mcy] % 256) > 0) {
+            if (square_blocked(mcx, mcy)) {
                 k = 0;
                 break;
             }
@@ -189,6 +326,93 @@ int checkray(double x1, double y1, double x2, double y2, int steps) {
     return k;
 }
 
+//walks every square of a w x h grid the segment touches (Amanatides-Woo grid traversal) and stops at the first one
+//for which blocked(x, y) is true; row/column 0 and squares outside the grid never block
+template <class F>
+int traverse_clear(int w, int h, F blocked, double x1, double y1, double x2, double y2) {
+    int mcx = (int)floor(x1), mcy = (int)floor(y1); //current square
+    int n = abs((int)floor(x2) - mcx) + abs((int)floor(y2) - mcy); //squares left to cross
+    double dx = x2 - x1, dy = y2 - y1;
+    int sx = (dx > 0) ? 1 : -1, sy = (dy > 0) ? 1 : -1;
+    double tdx = (dx != 0) ? fabs(1.0 / dx) : 1e30; //segment fraction needed to cross one whole square
+    double tdy = (dy != 0) ? fabs(1.0 / dy) : 1e30;
+    double tx = (dx != 0) ? ((dx > 0) ? (mcx + 1 - x1) : (x1 - mcx)) * tdx : 1e30; //segment fraction to the next vertical grid line
+    double ty = (dy != 0) ? ((dy > 0) ? (mcy + 1 - y1) : (y1 - mcy)) * tdy : 1e30; //...and the next horizontal one
+
+    for (int i = 0;; i++) {
+        if ((mcx > 0) && (mcy > 0) && (mcx < w) && (mcy < h) && blocked(mcx, mcy)) return 0;
+        if (i == n) break;
+        if (tx < ty) {
+            tx += tdx;
+            mcx += sx;
+        }
+        else {
+            ty += tdy;
+            mcy += sy;
+        }
+    }
+    return 1;
+}
+
+//exact version of checkray(): walks every map square the segment touches and stops at the first one that blocks;
+//cost is proportional to the number of squares crossed
+int checkline(double x1, double y1, double x2, double y2) {
+    return traverse_clear(map_size, map_size, square_blocked, x1, y1, x2, y2);
+}
+
+//checkline() on the solid bit grid: the same squares, but every map row the segment crosses is tested in one go
+int checkline_bits(double x1, double y1, double x2, double y2) {
+    return solid.segment_clear(x1, y1, x2, y2, 1);
+}
+
+//separable box blur of a rows x cols grid (row-major) with the given radius, for output region [r0,r1) x [c0,c1).
+//src is blurred along rows into tmp, then tmp across rows into dst (ping-pong, no copies); src and dst must differ.
+//Both passes use running sums, so the cost does not depend on the radius; the second pass works on whole rows
+//at a time, which the compiler vectorizes. Windows are clamped at the grid edges.
+void box_blur(const double* src, double* tmp, double* dst, int rows, int cols, int radius, int r0, int c0, int r1, int c1) {
+    int ra = (r0 - radius > 0) ? r0 - radius : 0; //tmp rows the second pass reads
+    int rb = (r1 + radius < rows) ? r1 + radius : rows;
+    std::vector<double> acc(cols);
+
+    for (int r = ra; r < rb; r++) { //pass 1: along each row
+        const double* in = src + (size_t)r * cols;
+        double* out = tmp + (size_t)r * cols;
+        int lo = (c0 - radius > 0) ? c0 - radius : 0, hi = (c0 + radius < cols - 1) ? c0 + radius : cols - 1; //window of column c
+        double sum = 0;
+        for (int c = lo; c <= hi; c++) sum += in[c];
+        for (int c = c0; c < c1; c++) {
+            out[c] = sum / (hi - lo + 1);
+            if (c + 1 + radius < cols) sum += in[++hi];
+            if (c - radius >= 0) sum -= in[lo++];
+        }
+    }
+
+    int lo = ra, hi = (r0 + radius < rows - 1) ? r0 + radius : rows - 1; //pass 2: across rows, window of row r
+    for (int c = c0; c < c1; c++) acc[c] = 0;
+    for (int r = lo; r <= hi; r++)
+        for (int c = c0; c < c1; c++) acc[c] += tmp[(size_t)r * cols + c];
+    for (int r = r0; r < r1; r++) {
+        double inv = 1.0 / (hi - lo + 1);
+        double* out = dst + (size_t)r * cols;
+        for (int c = c0; c < c1; c++) out[c] = acc[c] * inv;
+        if (r + 1 + radius < rows) {
+            const double* add = tmp + (size_t)(++hi) * cols;
+            for (int c = c0; c < c1; c++) acc[c] += add[c];
+        }
+        if (r - radius >= 0) {
+            const double* sub = tmp + (size_t)(lo++) * cols;
+            for (int c = c0; c < c1; c++) acc[c] -= sub[c];
+        }
+    }
+}
+
+//64-bit FNV-1a hash of a block of memory; pass the previous result as h to hash several blocks together
+unsigned long long hash_bytes(const void* data, size_t size, unsigned long long h = 14695981039346656037ull) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
 //*********************************************************************************************************************
 
 void clear_buffers() {
@@ -206,24 +430,45 @@ void show_map() //just show the map on the screen, good for debugging map genera
     for (int x = 0; x < map_size; x++)
         for (int y = 0; y < map_size; y++) {
             char_buff[x + y * res_X] = '#';
-            color_buff[x + y * res_X] = 4 * ((map[x][y] % 256) > 0);
+            color_buff[x + y * res_X] = 4 * (map[x][y].wall > 0);
         }
 }
 
 //**********************************************************************************************************************
+//a closed door on square (x, y); door_index must have been cleared with the map (clear_doors())
+void add_door(int x, int y) {
+    door_t door = { x, y, 1, 0, 0 };
+    door_index[x][y] = (int)doors.size();
+    doors.push_back(door);
+}
+
+void clear_doors() {
+    doors.clear();
+    moving_doors.clear();
+    for (int x = 0; x < map_size; x++)
+        for (int y = 0; y < map_size; y++) door_index[x][y] = -1;
+}
+
+//puts a cell on square (x, y), with a door if it is one
+void set_cell(int x, int y, cell_t c) {
+    map[x][y] = c;
+    if ((c.wall >= 200) && (c.wall <= 202)) add_door(x, y);
+    update_cell_bits(x, y);
+}
+
 void map_row(const char* str, int row) //reads a string and generates a map row from it; 'a'=wall type 1, 'b' = 2 etc.
 {
     int i = 0;
     char c;
     while (str[i]) {
         c = str[i];
-        if (c == ' ') map[i][row] = 0 + 1 * 256 + 3 * 65536;
-        else if (c == 'a') map[i][row] = 1 + 1 * 256 + 3 * 65536;
-        else if (c == 'b') map[i][row] = 2 + 1 * 256 + 3 * 65536;
-        else if (c == '1') { map[i][row] = 200 + 256 * 1 + 65536 * 1 + numd * 16777216; mapanims[numd][0] = 1; numd++; }
-        else if (c == '2') { map[i][row] = 201 + 256 * 1 + 65536 * 1 + numd * 16777216; mapanims[numd][0] = 1; numd++; }
-        else if (c == '8') { map[i][row] = 202 + 256 * 1 + 65536 * 1 + numd * 16777216; mapanims[numd][0] = 1; numd++; }
-        else if (c == '_') map[i][row] = 0 + 4 * 256;
+        if (c == ' ') set_cell(i, row, { 0, 1, 3, 0 }); //wall, floor, ceiling, unused
+        else if (c == 'a') set_cell(i, row, { 1, 1, 3, 0 });
+        else if (c == 'b') set_cell(i, row, { 2, 1, 3, 0 });
+        else if (c == '1') set_cell(i, row, { 200, 1, 1, 0 });
+        else if (c == '2') set_cell(i, row, { 201, 1, 1, 0 });
+        else if (c == '8') set_cell(i, row, { 202, 1, 1, 0 });
+        else if (c == '_') set_cell(i, row, { 0, 4, 0, 0 });
         i++;
     };
 }
@@ -234,13 +479,14 @@ void map_row(const char* str, int row) //reads a string and generates a map row
 
 void gen_texture(int number, int type, int p1, int p2, int p3, int p4, int p5, int p6) //generate texture at given number; parameters p1-p4 depend on type 
 {
+    auto roll = [&](int n, int x, int y, int k) { return rng::below(n, settings::seed, rng::stream(rng::textures, number), 2 * (x + y * 32) + k); }; //k-th random number of texel x,y, 0..n-1
 
     if (type == 0) //brick texture: p1=brick brightness, p2=mortar brightness, p3=brick height, p4=brick row offset, p5=brick color, p6=mortar color
     {
         for (int x = 0; x < 32; x++) //texture generation
             for (int y = 0; y < 32; y++) {
-                textures[x + y * 32 + 1024 * number] = (p1 - p2 * ((y % p3 == 0) || ((x + p4 * (y / p3)) % 16 == 0)) + rand() % 2) + (p5 + (p6 - p5) * ((y % p3 == 0) || ((x + p4 * (y / p3)) % 16 == 0))) * 256;
-                textures[x + y * 32 + 1024 * number] += 65536 * (128 + 64 * ((y % p3 == 0) || ((x + p4 * (y / p3) - 1) % 16 == 0)) - 64 * ((y % p3 == 0) || ((x + p4 * (y / p3) + 1) % 16 == 0)) + rand() % 32 - 16); //surface normal - bricks+some roughness
+                textures[x + y * 32 + 1024 * number] = (p1 - p2 * ((y % p3 == 0) || ((x + p4 * (y / p3)) % 16 == 0)) + roll(2, x, y, 0)) + (p5 + (p6 - p5) * ((y % p3 == 0) || ((x + p4 * (y / p3)) % 16 == 0))) * 256;
+                textures[x + y * 32 + 1024 * number] += 65536 * (128 + 64 * ((y % p3 == 0) || ((x + p4 * (y / p3) - 1) % 16 == 0)) - 64 * ((y % p3 == 0) || ((x + p4 * (y / p3) + 1) % 16 == 0)) + roll(32, x, y, 1) - 16); //surface normal - bricks+some roughness
             }
     }
 
@@ -248,8 +494,8 @@ void gen_texture(int number, int type, int p1, int p2, int p3, int p4, int p5, i
     {
         for (int x = 0; x < 32; x++) //texture generation
             for (int y = 0; y < 32; y++) {
-                textures[x + y * 32 + 1024 * number] = p1 - p2 * ((y % 31 == 0) || ((x + 4 * (y / 31)) % 16 == 0)) + rand() % 2 + p3 * 256;
-                textures[x + y * 32 + 1024 * number] += 65536 * (128 + rand() % 32 - 16); //surface normal - random roughness
+                textures[x + y * 32 + 1024 * number] = p1 - p2 * ((y % 31 == 0) || ((x + 4 * (y / 31)) % 16 == 0)) + roll(2, x, y, 0) + p3 * 256;
+                textures[x + y * 32 + 1024 * number] += 65536 * (128 + roll(32, x, y, 1) - 16); //surface normal - random roughness
             }
     }
     if (type == 2) //large, monocolored bricks/plates; p1=brick brightness, p2=mortar brightness, p3=color
@@ -258,7 +504,7 @@ void gen_texture(int number, int type, int p1, int p2, int p3, int p4, int p5, i
             for (int y = 0; y < 32; y++) {
                 int ins = ((x > 4) && (x < 27) && (y > 5) && (y < 26)); //inside square
 
-                textures[x + y * 32 + 1024 * number] = (12 + rand() % 5) + (7 + ins - 2 * ((x > 5) && (x < 8) && (y == 16))) * 256; //Door
+                textures[x + y * 32 + 1024 * number] = (12 + roll(5, x, y, 0)) + (7 + ins - 2 * ((x > 5) && (x < 8) && (y == 16))) * 256; //Door
                 textures[x + y * 32 + 1024 * number] += 65536 * (128 - 96 * ins * (x == 5) + 96 * ins * (x == 26)); //normal map
                 //textures[x + y * 32 + 1024 * number] = x ^ y;
                 //textures[x + y * 32 + 1024 * number] += 65536 * (128 + rand() % 32 - 16); //surface normal - random roughness
@@ -294,7 +540,7 @@ void gen_sky(int brightness) {
 
     for (int x = 0; x < res_X * 2; x++)
         for (int y = 0; y < res_Y; y++)
-            sky_randoms[x + y * 2 * res_X] = rand() % brightness; //generate map of random values
+            sky_randoms[x + y * 2 * res_X] = rng::below(brightness, settings::seed, rng::stream(rng::sky, 0), x + y * 2 * res_X); //generate map of random values
 
     for (int iter = 1; iter < 8; iter++) //7 iterations of Perlin noise	
         for (int x = 0; x < res_X * 2; x++)
@@ -307,6 +553,97 @@ void gen_sky(int brightness) {
 // 										Pac-man map
 //*********************************************************************************************************************
 
+//adds an enemy to the pool and returns its slot; reuses a free slot if there is one
+int spawn_enemy(double x, double y, int type) {
+    int i;
+    if (!enemies.free_slots.empty()) {
+        i = enemies.free_slots.back();
+        enemies.free_slots.pop_back();
+    }
+    else {
+        i = enemies.count++;
+        if (i >= (int)enemies.x.size()) { //grow by 4 padded slots
+            int padded = (enemies.count + 3) / 4 * 4;
+            enemies.x.resize(padded, 0);
+            enemies.y.resize(padded, 0);
+            enemies.vx.resize(padded, 0);
+            enemies.vy.resize(padded, 0);
+            enemies.hp.resize(padded, 0);
+            enemies.type.resize(padded, 0);
+            enemies.enabled.resize(padded, 0);
+            enemies.lod.resize(padded, 0);
+            enemies.seen.resize(padded, 0);
+            enemy_routes.resize(padded);
+        }
+    }
+    enemies.x[i] = (float)x;
+    enemies.y[i] = (float)y;
+    enemies.vx[i] = enemies.vy[i] = 0;
+    enemies.hp[i] = 4;
+    enemies.type[i] = type;
+    enemies.enabled[i] = 1;
+    enemies.lod[i] = 0; //full rate until move_enemies() has had a look
+    enemies.seen[i] = g_time - lod_sight_ticks; //not seen yet
+    enemy_routes[i] = route_t();
+    return i;
+}
+
+//takes an enemy off the map and frees its slot
+void remove_enemy(int i) {
+    enemies.enabled[i] = 0;
+    enemies.vx[i] = enemies.vy[i] = 0; //parked: the movement kernel leaves it alone
+    enemies.free_slots.push_back(i);
+}
+
+//removes every enemy and forgets the slots
+void clear_enemies() {
+    enemies.x.clear();
+    enemies.y.clear();
+    enemies.vx.clear();
+    enemies.vy.clear();
+    enemies.hp.clear();
+    enemies.type.clear();
+    enemies.enabled.clear();
+    enemies.lod.clear();
+    enemies.seen.clear();
+    enemies.free_slots.clear();
+    enemies.count = 0;
+    enemy_routes.clear();
+}
+
+//adds a projectile and returns its slot, or -1 when all are in flight
+int spawn_projectile(double x, double y, double vx, double vy, int type, double dmg) {
+    if (projectiles.free_count < 0) { //first use: every slot is free
+        projectiles.free_count = 0;
+        for (int i = max_projectiles - 1; i >= 0; i--) projectiles.free_slots[projectiles.free_count++] = i;
+    }
+    if (projectiles.free_count == 0) return -1;
+    int i = projectiles.free_slots[--projectiles.free_count];
+    projectiles.x[i] = (float)x;
+    projectiles.y[i] = (float)y;
+    projectiles.vx[i] = (float)vx;
+    projectiles.vy[i] = (float)vy;
+    projectiles.type[i] = type;
+    projectiles.dmg[i] = (float)dmg;
+    projectiles.light[i] = i % 8;
+    return i;
+}
+
+void remove_projectile(int i) {
+    projectiles.type[i] = 0;
+    projectiles.vx[i] = projectiles.vy[i] = 0;
+    projectiles.free_slots[projectiles.free_count++] = i;
+}
+
+//re-sorts enabled enemies into enemy_grid; damage, projectile hits, separation and sprite culling all read it
+void update_enemy_grid() {
+    enemy_grid.build(map_size, map_size, enemy_grid_cell, enemies.count, [](int i, double& x, double& y) {
+        x = enemies.x[i];
+        y = enemies.y[i];
+        return enemies.enabled[i] == 1;
+    });
+}
+
 std::vector < std::string > loadPacMap(const std::string& filename) {
     std::vector < std::string > mapData;
     std::ifstream file(filename);
@@ -336,6 +673,112 @@ void loadMap(std::string path) {
     }
 }
 
+//*********************************************************************************************************************
+// 										Compiled maps
+//*********************************************************************************************************************
+//maps/<name>.pmap is maps/<name>.pac compiled with -compilemap (layout in mapbin.h). It is preferred over the .pac
+//unless older than it: the file is mapped, checked, and its cells, lights and spawns read straight from the mapping;
+//its baked lightmap is used in place by calculate_lights() as long as its key still matches.
+
+mapped_file compiled_map; //.pmap the current map was loaded from; lightmap/light_raw may point into it
+mapbin::map_view compiled_view;
+
+//lights and spawn points of maps loaded from .pac, which has no room for them
+void default_map_extras(std::vector<mapbin::light>& lights, std::vector<mapbin::spawn>& spawns) {
+    lights = {
+        { 2.5, 20.5, 40, 0 }, //left-down corner
+        { 20.5, 20.5, 40, 0 }, //right-down corner
+        { 2.5, 2.5, 40, 0 }, //left-up corner
+        { 20.5, 2.5, 40, 0 }, //right-up corner
+    };
+    spawns = {
+        { 9.5, 20.5, -1, 0 }, //player
+        { 8.5, 16.5, 0, 0 }, //Blinky
+        { 9.5, 16.5, 1, 0 }, //Pinky
+        { 10.5, 16.5, 2, 0 }, //Inky
+        { 11.5, 16.5, 3, 0 }, //Clyde
+    };
+}
+
+//places lights, the player and ghosts; enemies must have been cleared
+void apply_map_extras(const mapbin::light* lights, size_t light_count, const mapbin::spawn* spawns, size_t spawn_count) {
+    memset(static_lights, 0, sizeof(static_lights));
+    for (size_t i = 0; i < light_count; i++) {
+        static_lights[i][0] = lights[i].x;
+        static_lights[i][1] = lights[i].y;
+        static_lights[i][2] = lights[i].strength;
+        static_lights[i][3] = lights[i].height;
+    }
+    for (size_t i = 0; i < spawn_count; i++) {
+        if (spawns[i].kind >= 0) spawn_enemy(spawns[i].x, spawns[i].y, spawns[i].kind);
+        else {
+            player.x = spawns[i].x;
+            player.y = spawns[i].y;
+        }
+    }
+}
+
+//points lightmap/light_raw back at our own buffers if they were in the compiled map, and unmaps it
+void close_compiled_map() {
+    if (((char*)light_raw >= compiled_map.data) && ((char*)light_raw < compiled_map.data + compiled_map.size)) {
+        light_raw = light_raw_buf;
+        lightmap = lightmap_buf;
+    }
+    close_mapped(compiled_map);
+    compiled_view = mapbin::map_view();
+}
+
+//true if every record holds values the game can use: cells with existing textures, lights that fit static_lights,
+//spawns inside the map
+bool compiled_map_usable(const mapbin::map_view& v) {
+    const mapbin::header& h = *v.head;
+    if ((h.width != map_size) || (h.height != map_size) || (h.lights.count > max_lights)) return false;
+    for (size_t i = 0; i < h.cells.count; i++) {
+        const mapbin::cell& c = v.cells[i];
+        if (((c.wall >= 64) && ((c.wall < 200) || (c.wall > 202))) || (c.floor >= 63) || (c.ceiling >= 64)) return false;
+    }
+    for (size_t i = 0; i < h.spawns.count; i++) {
+        const mapbin::spawn& p = v.spawns[i];
+        if ((p.kind < -1) || (p.kind > 3) || !(p.x >= 0) || !(p.x < map_size) || !(p.y >= 0) || !(p.y < map_size)) return false;
+    }
+    return true;
+}
+
+//true if name.pmap exists and is not older than name.pac
+bool compiled_map_current(const std::string& name) {
+    std::error_code error;
+    auto compiled = std::filesystem::last_write_time(name + ".pmap", error);
+    if (error) return false;
+    auto source = std::filesystem::last_write_time(name + ".pac", error);
+    return error || (compiled >= source);
+}
+
+//loads a compiled map into a cleared map; false if there is none, or it is unusable (then nothing was changed)
+bool load_compiled_map(const std::string& path) {
+    if (!open_mapped(compiled_map, path)) return false;
+    if (!mapbin::view(compiled_map.data, compiled_map.size, compiled_view) || !compiled_map_usable(compiled_view)) {
+        std::cerr << "Ignoring invalid compiled map: " << path << std::endl;
+        close_compiled_map();
+        return false;
+    }
+
+    for (int y = 0; y < map_size; y++) //row by row, so doors are numbered like loadMap() numbers them
+        for (int x = 0; x < map_size; x++) {
+            const mapbin::cell& c = compiled_view.cells[x * map_size + y];
+            set_cell(x, y, { c.wall, c.floor, c.ceiling, 0 });
+        }
+    apply_map_extras(compiled_view.lights, compiled_view.head->lights.count, compiled_view.spawns, compiled_view.head->spawns.count);
+    return true;
+}
+
+//points light_raw/lightmap at the compiled map's baked lightmap if it was baked for key
+bool use_compiled_lightmap(unsigned long long key) {
+    if (!compiled_view.lightmap || (compiled_view.head->lightmap_key != key)) return false;
+    light_raw = (double(*)[map_size * 16])compiled_view.lightmap;
+    lightmap = light_raw + map_size * 16;
+    return true;
+}
+
 void listFilesWithExtension(const std::string& path,
     const std::string& extension) {
     try {
@@ -350,7 +793,8 @@ void listFilesWithExtension(const std::string& path,
     }
 }
 
-void gen_map_pacman(std::string path) {
+//compiled = false reads the .pac even if there is a compiled map
+void gen_map_pacman(std::string path, bool compiled = true) {
     //some global settings
     //Light settings
     light_global = 0.05;
@@ -369,7 +813,11 @@ void gen_map_pacman(std::string path) {
 
     for (int x = 0; x < map_size; x++)
         for (int y = 0; y < map_size; y++)
-            map[x][y] = 0 + 256 * 1; //clear map
+            map[x][y] = { 0, 1, 0, 0 }; //clear map
+    clear_doors();
+    solid.clear();
+    door_bits.clear();
+    map_version++;
     /*
     map_row("aaaaaaaaaaaaaaaaaaaaaaa",0);
     map_row("aaaaaaaaaaaaaaaaaaaaaaa",1);
@@ -395,57 +843,43 @@ void gen_map_pacman(std::string path) {
     map_row("aaaaaaaaaaaaaaaaaaaaaaa",21);
     map_row("aaaaaaaaaaaaaaaaaaaaaaa",22);
     */
-    if (path != "D")
-        loadMap("maps/" + path + ".pac");
-    else
-        loadMap("maps/default.pac");
-
-    player.x = 9.5;
-    player.y = 20.5;
-
-    static_lights[0][0] = 2.5; //left-down corner
-    static_lights[0][1] = 20.5;
-    static_lights[0][2] = 40;
-
-    static_lights[1][0] = 20.5; //right-down corner
-    static_lights[1][1] = 20.5;
-    static_lights[1][2] = 40;
-
-    static_lights[2][0] = 2.5; //left-up corner
-    static_lights[2][1] = 2.5;
-    static_lights[2][2] = 40;
-
-    static_lights[3][0] = 20.5; //right-up corner
-    static_lights[3][1] = 2.5;
-    static_lights[3][2] = 40;
-
+    clear_enemies();
     gen_pacman_ghost(0, 30, 4); //Blinky: sprite #1, brightness 30, color 4 (red)
-    enemies[0].x = 8.5;
-    enemies[0].y = 16.5;
-    enemies[0].enabled = 1;
-    enemies[0].type = 0;
-    enemies[0].z = 32;
-
     gen_pacman_ghost(1, 30, 5); //Pinky: sprite #2, brightness 30, color 5 (magenta)
-    enemies[1].x = 9.5;
-    enemies[1].y = 16.5;
-    enemies[1].enabled = 1;
-    enemies[1].type = 1;
-    enemies[1].z = 32;
-
     gen_pacman_ghost(2, 30, 2); //Inky: sprite #2, brightness 30, color 2 (cyan)
-    enemies[2].x = 10.5;
-    enemies[2].y = 16.5;
-    enemies[2].enabled = 1;
-    enemies[2].type = 2;
-    enemies[2].z = 32;
-
     gen_pacman_ghost(3, 30, 6); //Clyde: sprite #3, brightness 30, color 6 (yellow)
-    enemies[3].x = 11.5;
-    enemies[3].y = 16.5;
-    enemies[3].enabled = 1;
-    enemies[3].type = 3;
-    enemies[3].z = 32;
+
+    std::string name = "maps/" + ((path != "D") ? path : std::string("default"));
+    close_compiled_map();
+    if (!compiled || !compiled_map_current(name) || !load_compiled_map(name + ".pmap")) {
+        loadMap(name + ".pac");
+        std::vector<mapbin::light> lights;
+        std::vector<mapbin::spawn> spawns;
+        default_map_extras(lights, spawns);
+        apply_map_extras(lights.data(), lights.size(), spawns.data(), spawns.size());
+    }
+
+    std::vector<int> floor_squares; //x * map_size + y of every floor square ghosts can be put on
+    for (int x = 1; x < map_size - 1; x++)
+        for (int y = 1; y < map_size - 1; y++)
+            if (map[x][y].wall == 0) floor_squares.push_back(x * map_size + y);
+    if ((settings::arena_ghosts > 0) && floor_squares.empty()) std::cerr << "No floor square for the extra ghosts" << std::endl;
+    else for (int i = 0; i < settings::arena_ghosts; i++) { //extra ghosts on random floor squares, for stress tests
+        const int tries = 64;
+        int x, y, k = 0;
+        do { //retry until the square is floor; every ghost has its own numbers
+            x = 1 + rng::below(map_size - 2, settings::seed, rng::stream(rng::spawns, i), k++);
+            y = 1 + rng::below(map_size - 2, settings::seed, rng::stream(rng::spawns, i), k++);
+        } while ((map[x][y].wall > 0) && (k < 2 * tries));
+        if (map[x][y].wall > 0) { //mostly walls: pick from the floor squares instead
+            int square = floor_squares[rng::below((int)floor_squares.size(), settings::seed, rng::stream(rng::spawns, i), k)];
+            x = square / map_size;
+            y = square % map_size;
+        }
+        spawn_enemy(x + 0.5, y + 0.5, i % 4);
+    }
+    update_enemy_grid();
+    pathfinder.build(map_size, map_size, path_cluster, [](int x, int y) { return !square_blocked(x, y); });
 }
 
 
@@ -454,49 +888,84 @@ void gen_map_pacman(std::string path) {
 // 										Initialization - Loading Files
 //*********************************************************************************************************************
 
+//*********************************************************************************************************************
+// 										Palette lookup
+//*********************************************************************************************************************
+//Imported pixels are matched to the nearest of the first sprite_colors pal2 colours. pal2_lut holds the answer for
+//every 8x8x8 block of RGB values; a block whose colours do not all have the same nearest entry is marked pal2_mixed
+//and searched in full, so the lookup always agrees with the search.
+
+const int sprite_colors = 19; //pal2 entries imported pixels are matched to
+const unsigned char pal2_mixed = 255;
+unsigned char pal2_lut[32 * 32 * 32]; //by (r / 8) * 1024 + (g / 8) * 32 + b / 8
+bool pal2_lut_built = false;
+
+//nearest sprite colour by summed channel difference; on ties the lower index
+int nearest_pal2_search(int r, int g, int b) {
+    int best = 0, best_dist = 256 * 3;
+    for (int i = 0; i < sprite_colors; i++) {
+        int dist = abs(pal2[i][0] - r) + abs(pal2[i][1] - g) + abs(pal2[i][2] - b);
+        if (dist < best_dist) {
+            best_dist = dist;
+            best = i;
+        }
+    }
+    return best;
+}
+
+void build_pal2_lut() {
+    for (int block = 0; block < 32 * 32 * 32; block++) {
+        int lo[3] = { (block >> 10) * 8, ((block >> 5) & 31) * 8, (block & 31) * 8 };
+        int best = nearest_pal2_search(lo[0], lo[1], lo[2]);
+        bool same = true; //does best win everywhere in the block, ties included?
+        for (int i = 0; (i < sprite_colors) && same; i++) {
+            if (i == best) continue;
+            int lead = 0; //most that entry best can be farther than entry i; channels add up independently
+            for (int c = 0; c < 3; c++) {
+                int most = -256;
+                for (int v = lo[c]; v < lo[c] + 8; v++) most = std::max(most, abs(pal2[best][c] - v) - abs(pal2[i][c] - v));
+                lead += most;
+            }
+            same = (i < best) ? (lead < 0) : (lead <= 0);
+        }
+        pal2_lut[block] = same ? best : pal2_mixed;
+    }
+    pal2_lut_built = true;
+}
+
+inline int nearest_pal2(int r, int g, int b) {
+    int i = pal2_lut[(r >> 3) * 1024 + (g >> 3) * 32 + (b >> 3)];
+    return (i != pal2_mixed) ? i : nearest_pal2_search(r, g, b);
+}
+
 void loadsprites()
 {
-    Uint32 cc;
-    int r, g, b;
-    int brt, bco, dist, mindist;
-    SDL_Surface* sprsheet = SDL_LoadBMP("sprites.bmp");
+    SDL_Surface* loaded = SDL_LoadBMP("sprites.bmp");
+    SDL_Surface* sprsheet = loaded ? SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0) : NULL; //one known layout, so rows are read directly
+    if (loaded) SDL_FreeSurface(loaded);
+    if (!sprsheet || (sprsheet->w < 1 + 33 * 8) || (sprsheet->h < 1 + 33 * 8)) {
+        std::cerr << "Unable to load sprites.bmp (64 frames of 32x32 in an 8x8 grid)" << std::endl;
+        if (sprsheet) SDL_FreeSurface(sprsheet);
+        return;
+    }
+    if (!pal2_lut_built) build_pal2_lut();
 
     //load enemy sprites (32x32)
+    SDL_LockSurface(sprsheet);
     for (int frame = 0; frame < 64; frame++)
-        for (int x2 = 0; x2 < 32; x2++)
-            for (int y2 = 0; y2 < 32; y2++)
+        for (int y2 = 0; y2 < 32; y2++)
+        {
+            const Uint32* row = (const Uint32*)((const Uint8*)sprsheet->pixels + (y2 + 1 + 33 * (frame / 8)) * sprsheet->pitch) + 1 + 33 * (frame % 8);
+            unsigned short int* out = &sprites2[y2 * 32 + 1024 * frame];
+            for (int x2 = 0; x2 < 32; x2++)
             {
-                cc = getpixel(sprsheet, x2 + 1 + 33 * (frame % 8), y2 + 1 + 33 * (frame / 8));
-
-                SDL_Color rgb;
-                SDL_GetRGB(cc, sprsheet->format, &rgb.r, &rgb.g, &rgb.b);
-
-                r = rgb.r;
-                g = rgb.g;
-                b = rgb.b;
-
-                brt = (r + g + b) / 16;
-
-                int ccf = 0;
-                int cdst = 0;
-                int cmindst = 256 * 3;
-                for (int i = 0; i < 19; i++)
-                {
-                    cdst = abs(pal2[i][0] - r) + abs(pal2[i][1] - g) + abs(pal2[i][2] - b);
-                    if (cdst < cmindst) { cmindst = cdst; ccf = i; };
-                }
-
-                if (brt < 47)
-                {
-                    sprites2[x2 + y2 * 32 + 1024 * frame] = (brt / 4 + 1) % 256;
-                    sprites2[x2 + y2 * 32 + 1024 * frame] += 256 * (ccf % 256);
-                }
-                else
-                {
-                    sprites2[x2 + y2 * 32 + 1024 * frame] = 0;
-                }
-
+                int r = (row[x2] >> 16) & 255, g = (row[x2] >> 8) & 255, b = row[x2] & 255;
+                int brt = (r + g + b) / 16;
+                out[x2] = (brt < 47) ? (brt / 4 + 1) + 256 * nearest_pal2(r, g, b) : 0;
             }
+        }
+    SDL_UnlockSurface(sprsheet);
+    SDL_FreeSurface(sprsheet);
 }
 
 //*********************************************************************************************************************
@@ -558,37 +1027,373 @@ void set_palette() {
 // 										Initialization - light precalculation
 //*********************************************************************************************************************
 
-void calculate_lights() {
+//map square at (depth, col) of one of the 4 shadowcasting quadrants around the origin square
+void quadrant_square(int quadrant, int ox, int oy, int depth, int col, int& x, int& y) {
+    switch (quadrant) {
+    case 0: x = ox + col; y = oy - depth; break; //north
+    case 1: x = ox + depth; y = oy + col; break; //east
+    case 2: x = ox + col; y = oy + depth; break; //south
+    default: x = ox - depth; y = oy + col; //west
+    }
+}
+
+//same rules as checkline(): row/column 0 never blocks, outside the map always does
+int shadow_blocks(int x, int y) {
+    return (x < 0) || (y < 0) || (x >= map_size) || (y >= map_size) || ((x > 0) && (y > 0) && square_blocked(x, y));
+}
+
+//symmetric recursive shadowcasting: scans one row of a quadrant between two slopes and recurses into the
+//unshadowed parts of the next row; vis gets 2 for squares visible from the center of the origin square
+//and 1 for squares the scan only grazed (partly in view)
+void shadowcast(int quadrant, int ox, int oy, int depth, double start_slope, double end_slope, int radius, char(*vis)[map_size]) {
+    if (depth > radius) return;
+    int min_col = (int)floor(depth * start_slope + 0.5);
+    int max_col = (int)ceil(depth * end_slope - 0.5);
+    int prev = -1; //previous square in this row: -1=none, 0=floor, 1=wall
+    int x, y;
+
+    for (int col = min_col; col <= max_col; col++) {
+        quadrant_square(quadrant, ox, oy, depth, col, x, y);
+        int wall = shadow_blocks(x, y);
+        if ((x >= 0) && (y >= 0) && (x < map_size) && (y < map_size)) {
+            if (wall || ((col >= depth * start_slope) && (col <= depth * end_slope))) vis[x][y] = 2;
+            else if (vis[x][y] == 0) vis[x][y] = 1;
+        }
+        if ((prev == 1) && !wall) start_slope = (2.0 * col - 1) / (2.0 * depth); //leaving a wall - shadow ends here
+        if ((prev == 0) && wall) shadowcast(quadrant, ox, oy, depth + 1, start_slope, (2.0 * col - 1) / (2.0 * depth), radius, vis); //wall starts - scan the lit part behind
+        prev = wall;
+    }
+    if (prev == 0) shadowcast(quadrant, ox, oy, depth + 1, start_slope, end_slope, radius, vis);
+}
+
+//finds the squares light i can see. A visible square whose 4 corner texels all have a clear line to the light is
+//lit everywhere (walls are squares no bigger than it, so none fits between the corner rays) and needs no per-texel
+//rays; squares around the scanned area keep a ray per texel; everything else is skipped
+void compute_light_mask(int i) {
+    char vis[map_size][map_size];
+    int radius = (int)light_radius + 1;
+    double lx = static_lights[i][0], ly = static_lights[i][1];
+    int ox = (int)lx, oy = (int)ly;
+    int band = ((lx - ox == 0.5) && (ly - oy == 0.5)) ? 1 : 2;
+    memset(vis, 0, sizeof(vis));
+    if ((ox >= 0) && (oy >= 0) && (ox < map_size) && (oy < map_size)) {
+        vis[ox][oy] = 2;
+        for (int q = 0; q < 4; q++) shadowcast(q, ox, oy, 1, -1, 1, radius, vis);
+    }
+
+    for (int x = 0; x < map_size; x++)
+        for (int y = 0; y < map_size; y++) {
+            int seen = 0; //scanned squares nearby; the scan starts at the square center, so off-center lights need a wider band
+            for (int nx = x - band; nx <= x + band; nx++)
+                for (int ny = y - band; ny <= y + band; ny++)
+                    if ((nx >= 0) && (ny >= 0) && (nx < map_size) && (ny < map_size)) seen += (vis[nx][ny] > 0);
+            light_masks[i][x][y] = (seen > 0);
+
+            double e = 15.0 / 16.0; //last texel of the square
+            if ((vis[x][y] == 2) && !shadow_blocks(x, y) && checkline(x, y, lx, ly) && checkline(x + e, y, lx, ly) && checkline(x, y + e, lx, ly) && checkline(x + e, y + e, lx, ly))
+                light_masks[i][x][y] = 2;
+        }
+}
+
+void compute_light_masks() {
+    for (int i = 0; i < max_lights; i++)
+        if (static_lights[i][2] != 0) compute_light_mask(i);
+}
+
+//accumulates all static lights plus sky light into dst, for lightmap region [x0,x1) x [y0,y1)
+//needs up-to-date light_masks (compute_light_masks())
+void bake_lights(int x0, int y0, int x1, int y1, double(*dst)[map_size * 16]) {
     double cx, cy; //current coordinates
     int k;
 
-    for (int i = 0; i < 64; i++) //go through all lights
-        for (int x = 1; x < map_size * 16; x++) //go through whole lightmap, x coord.
-            if (fabs(x / 16 - static_lights[i][0]) < 12) //light closer than 12 squares?
-                for (int y = 1; y < map_size * 16; y++) //go through whole lightmap, y coord.
-                    if (fabs(y / 16 - static_lights[i][1]) < 12) //light closer than 12 squares?
-                    {
-                        cx = 1.0 / 16.0 * x; //map coordinate x
-                        cy = 1.0 / 16.0 * y; //map coordinate y
+    for (int x = x0; x < x1; x++)
+        for (int y = y0; y < y1; y++)
+            dst[x][y] = 0;
+
+    for (int i = 0; i < max_lights; i++) //go through all lights
+        if (static_lights[i][2] != 0) //unused slots contribute nothing
+            for (int mx = x0 / 16; mx <= (x1 - 1) / 16; mx++) //go through the map squares of the region
+                if (fabs(mx - static_lights[i][0]) < light_radius) //light closer than 12 squares?
+                    for (int my = y0 / 16; my <= (y1 - 1) / 16; my++)
+                        if ((fabs(my - static_lights[i][1]) < light_radius) && light_masks[i][mx][my]) //close and not in shadow?
+                            for (int x = (16 * mx > x0) ? 16 * mx : x0; (x < 16 * mx + 16) && (x < x1); x++)
+                                for (int y = (16 * my > y0) ? 16 * my : y0; (y < 16 * my + 16) && (y < y1); y++) {
+                                    cx = 1.0 / 16.0 * x; //map coordinate x
+                                    cy = 1.0 / 16.0 * y; //map coordinate y
+
+                                    double dst2 = (cx - static_lights[i][0]) * (cx - static_lights[i][0]) + (cy - static_lights[i][1]) * (cy - static_lights[i][1]); //distance to light
+                                    if (dst2 >= light_radius * light_radius) continue;
+                                    if (dst2 < 1.0 / 256) dst2 = 1.0 / 256; //texel right on the light; keeps it finite for the blur's running sums
+                                    k = (light_masks[i][mx][my] == 2) ? 1 : checkline(cx, cy, static_lights[i][0], static_lights[i][1]); //only edge squares need a ray
+                                    dst[x][y] += 1.0 * k * static_lights[i][2] / sqrt(dst2); //update lightmap
+                                }
+
+    for (int x = x0; x < x1; x++) //apply sky
+        for (int y = y0; y < y1; y++)
+            if ((x > 0) && (y > 0) && (x < map_size * 16 - 1) && (y < map_size * 16 - 1) && (map[x / 16][y / 16].ceiling == 0)) //sky tile?
+                dst[x][y] += sky_light;
+}
+
+//lightmap texels changed in light_raw region [x0,x1) x [y0,y1); re-blurs everything they affect into lightmap
+void blur_lights(int x0, int y0, int x1, int y1) {
+    int r = settings::light_blur;
+    x0 = (x0 - r > 0) ? x0 - r : 0;
+    y0 = (y0 - r > 0) ? y0 - r : 0;
+    x1 = (x1 + r < map_size * 16) ? x1 + r : map_size * 16;
+    y1 = (y1 + r < map_size * 16) ? y1 + r : map_size * 16;
+    box_blur(&light_raw[0][0], &light_tmp[0][0], &lightmap[0][0], map_size * 16, map_size * 16, r, x0, y0, x1, y1);
+}
+
+//bake_lights() split into 64x64 texel tiles baked in parallel; every texel belongs to exactly one tile
+//and sums its lights in a fixed order, so the result is the same for any number of threads
+void bake_lights_parallel(int x0, int y0, int x1, int y1, double(*dst)[map_size * 16], int threads) {
+    const int tile = 64;
+    int tiles_x = (x1 - x0 + tile - 1) / tile;
+    int tiles_y = (y1 - y0 + tile - 1) / tile;
+
+    jobs::parallel_for(tiles_x * tiles_y, threads, [&](int t) {
+        int tx0 = x0 + tile * (t % tiles_x), ty0 = y0 + tile * (t / tiles_x);
+        bake_lights(tx0, ty0, (tx0 + tile < x1) ? tx0 + tile : x1, (ty0 + tile < y1) ? ty0 + tile : y1, dst);
+    });
+}
+
+//times the full bake with 1-16 threads and checks every run gives the same lightmap
+void benchmark_lights() {
+    static double reference[map_size * 16][map_size * 16];
+    double t1 = 0;
+
+    std::cout << "Lightmap bake benchmark (" << jobs::hardware_threads() << " hardware threads)\n";
+    for (int threads = 1; threads <= 16; threads *= 2) {
+        auto start = std::chrono::steady_clock::now();
+        bake_lights_parallel(1, 1, map_size * 16, map_size * 16, light_tmp, threads);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-                        double dst = (cx - static_lights[i][0]) * (cx - static_lights[i][0]) + (cy - static_lights[i][1]) * (cy - static_lights[i][1]); //distance to light
-                        if (dst < 144) k = checkray(cx, cy, static_lights[i][0], static_lights[i][1], 256);
-                        else k = 0; //check if there is unobstructed line to the light
-                        lightmap[x][y] += 1.0 * k * static_lights[i][2] / sqrt(dst); //update lightmap
+        if (threads == 1) {
+            t1 = ms;
+            memcpy(reference, light_tmp, sizeof(reference));
+        }
+        std::cout << "  " << threads << " threads: " << ms << " ms, speedup " << t1 / ms << "x"
+            << (memcmp(reference, light_tmp, sizeof(reference)) ? ", RESULT DIFFERS" : "") << "\n";
+    }
+}
+
+//the light-to-texel segments the bake checks on the current map, as x1,y1,x2,y2
+void light_queries(std::vector<double>& queries) {
+    queries.clear();
+    for (int i = 0; i < max_lights; i++)
+        if (static_lights[i][2] != 0)
+            for (int x = 1; x < map_size * 16; x++)
+                for (int y = 1; y < map_size * 16; y++) {
+                    double cx = 1.0 / 16.0 * x, cy = 1.0 / 16.0 * y;
+                    if ((cx - static_lights[i][0]) * (cx - static_lights[i][0]) + (cy - static_lights[i][1]) * (cy - static_lights[i][1]) < light_radius * light_radius) {
+                        queries.push_back(cx);
+                        queries.push_back(cy);
+                        queries.push_back(static_lights[i][0]);
+                        queries.push_back(static_lights[i][1]);
                     }
+                }
+}
 
-    for (int x = 1; x < map_size * 16 - 1; x++) //apply sky
-        for (int y = 1; y < map_size * 16 - 1; y++)
-            if ((map[x / 16][y / 16] / 65536) == 0) //sky tile?
-                lightmap[x][y] += sky_light;
+//compares checkray() with checkline() on every map in maps/: the same light-to-texel queries as the bake
+void benchmark_rays() {
+    std::vector<double> queries; //x1,y1,x2,y2
+    std::vector<char> results;
+
+    std::cout << "Ray visibility benchmark: checkray(256 steps) vs checkline\n";
+    for (const auto& entry : std::filesystem::directory_iterator("maps")) {
+        if (entry.path().extension() != ".pac") continue;
+        gen_map_pacman(entry.path().stem().string());
+
+        light_queries(queries);
+        int count = (int)queries.size() / 4;
+        results.resize(count);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int q = 0; q < count; q++) results[q] = checkray(queries[4 * q], queries[4 * q + 1], queries[4 * q + 2], queries[4 * q + 3], 256);
+        double ms_ray = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        int seen = 0, missed = 0; //checkline blocked where the sampler saw through / the other way round
+        start = std::chrono::steady_clock::now();
+        for (int q = 0; q < count; q++) {
+            int k = checkline(queries[4 * q], queries[4 * q + 1], queries[4 * q + 2], queries[4 * q + 3]);
+            if (k < results[q]) seen++;
+            if (k > results[q]) missed++;
+        }
+        double ms_line = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-    for (int x = 1; x < map_size * 16 - 1; x++)
-        for (int y = 1; y < map_size * 16 - 1; y++)
-            light_tmp[x][y] = 0.2 * (lightmap[x][y] + lightmap[x + 1][y] + lightmap[x - 1][y] + lightmap[x][y + 1] + lightmap[x][y - 1]); //simple blur - average of neighbors
+        std::cout << "  " << entry.path().filename().string() << ": " << count << " queries, checkray " << ms_ray << " ms, checkline " << ms_line
+            << " ms; differing: " << seen << " sampler skipped a blocking square, " << missed << " sampler hit a square the segment does not cross\n";
+    }
+}
 
-    for (int x = 1; x < map_size * 16 - 1; x++)
-        for (int y = 1; y < map_size * 16 - 1; y++)
-            lightmap[x][y] = light_tmp[x][y]; //save the effect of blur
+//count random segments between lattice points (whole numbers plus offset) of a size x size grid, at most reach squares
+//apart along each axis: square centre to square centre, or corner to corner. Many of them pass exactly through grid
+//corners, where the traversals have to break ties the same way
+void lattice_queries(std::vector<double>& queries, int size, double offset, int count, int reach) {
+    queries.clear();
+    for (int i = 0; i < count; i++) {
+        auto roll = [&](int n, int k) { return rng::below(n, 1, rng::stream(rng::spawns, i), k); }; //fixed seed, so runs compare
+        int x1 = 1 + roll(size - 1, 0), y1 = 1 + roll(size - 1, 1);
+        int x2 = std::min(std::max(x1 + roll(2 * reach + 1, 2) - reach, 1), size - 1), y2 = std::min(std::max(y1 + roll(2 * reach + 1, 3) - reach, 1), size - 1);
+        queries.push_back(x1 + offset);
+        queries.push_back(y1 + offset);
+        queries.push_back(x2 + offset);
+        queries.push_back(y2 + offset);
+    }
+}
+
+//checks checkline_bits() against the square-by-square traversal and times both: the bake's light-to-texel queries and
+//lattice-aligned segments on every map in maps/, then random and lattice-aligned segments on a synthetic 1024x1024 map
+void benchmark_los() {
+    std::vector<double> queries; //x1,y1,x2,y2
+    std::vector<char> results;
+
+    //times both on queries; checkline_bits answers through bits_clear, the traversal through walk_clear
+    auto run = [&](const char* name, auto walk_clear, auto bits_clear) {
+        int count = (int)queries.size() / 4, differing = 0, clear = 0;
+        results.resize(count);
+        auto start = std::chrono::steady_clock::now();
+        for (int q = 0; q < count; q++) results[q] = walk_clear(queries[4 * q], queries[4 * q + 1], queries[4 * q + 2], queries[4 * q + 3]);
+        double s_walk = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int q = 0; q < count; q++) {
+            int k = bits_clear(queries[4 * q], queries[4 * q + 1], queries[4 * q + 2], queries[4 * q + 3]);
+            differing += (k != results[q]);
+            clear += k;
+        }
+        double s_bits = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << name << ": " << count << " queries (" << 100 * clear / count << "% clear), checkline " << 1e-6 * count / s_walk << " M/s, bits "
+            << 1e-6 * count / s_bits << " M/s; differing: " << differing << "\n";
+    };
+
+    std::cout << "Line of sight benchmark: checkline vs checkline_bits\n";
+    for (const auto& entry : std::filesystem::directory_iterator("maps")) {
+        if (entry.path().extension() != ".pac") continue;
+        gen_map_pacman(entry.path().stem().string());
+        std::string name = entry.path().filename().string();
+        light_queries(queries);
+        run(name.c_str(), checkline, checkline_bits);
+        lattice_queries(queries, map_size, 0.5, 200000, map_size);
+        run((name + " square centres").c_str(), checkline, checkline_bits);
+        lattice_queries(queries, map_size, 0, 200000, map_size);
+        run((name + " grid points").c_str(), checkline, checkline_bits);
+    }
+
+    const int size = 1024, count = 1000000;
+    auto blocked = [](int x, int y) { return (x == size - 1) || (y == size - 1) || (((unsigned)x * 73856093u ^ (unsigned)y * 19349663u) * 2654435761u >> 24) % 256 == 0; };
+    bitgrid::occupancy big(size, size);
+    for (int x = 0; x < size; x++)
+        for (int y = 0; y < size; y++) big.set(x, y, blocked(x, y));
+    auto walk_big = [&](double x1, double y1, double x2, double y2) { return traverse_clear(size, size, blocked, x1, y1, x2, y2); };
+    auto bits_big = [&](double x1, double y1, double x2, double y2) { return (int)big.segment_clear(x1, y1, x2, y2, 1); };
+    auto coord = [](int i, int k) { return rng::below(1 << 20, 1, rng::stream(rng::spawns, i), k) / 1024.0; }; //fixed seed, so runs compare
+
+    struct { const char* name; double along, across; } kinds[] = { //segment lengths: up to along in the main direction, across in the other
+        { "1024x1024 short (up to 16 squares)", 16, 16 },
+        { "1024x1024 long (up to 512 squares)", 512, 512 },
+        { "1024x1024 near-axis (up to 512 x 4 squares)", 512, 4 },
+    };
+    for (auto& kind : kinds) {
+        queries.clear();
+        for (int i = 0; i < count; i++) {
+            double x1 = coord(i, 0), y1 = coord(i, 1);
+            double a = (coord(i, 2) / size * 2 - 1) * kind.along, b = (coord(i, 3) / size * 2 - 1) * kind.across;
+            double x2 = (i % 2) ? x1 + a : x1 + b, y2 = (i % 2) ? y1 + b : y1 + a; //half along x, half along y
+            queries.push_back(x1);
+            queries.push_back(y1);
+            queries.push_back(std::min(std::max(x2, 0.0), size - 0.001));
+            queries.push_back(std::min(std::max(y2, 0.0), size - 0.001));
+        }
+        run(kind.name, walk_big, bits_big);
+    }
+    lattice_queries(queries, size - 1, 0.5, count, 64);
+    run("1024x1024 square centres (up to 64 squares)", walk_big, bits_big);
+    lattice_queries(queries, size - 1, 0, count, 64);
+    run("1024x1024 grid points (up to 64 squares)", walk_big, bits_big);
+}
+
+//*********************************************************************************************************************
+// 										Lightmap cache
+//*********************************************************************************************************************
+//cache/lightmap_<key>.bin holds light_raw followed by lightmap; the key hashes everything the bake depends on
+
+const int light_bake_version = 2; //bump whenever the bake or blur changes, so old cache files are not used
+
+struct light_cache_header {
+    char magic[4]; //"PLMC"
+    int version; //light_bake_version
+    unsigned long long key; //light_cache_key() of the inputs
+    unsigned long long size; //bytes of lightmap data following the header
+};
+
+mapped_file light_cache; //cache file lightmap/light_raw currently point into
+
+unsigned long long light_cache_key() {
+    unsigned long long h = hash_bytes(&light_bake_version, sizeof(light_bake_version));
+    h = hash_bytes(map, sizeof(map), h); //walls, sky, doors
+    h = hash_bytes(doors.data(), doors.size() * sizeof(door_t), h); //door states decide what blocks light
+    h = hash_bytes(static_lights, sizeof(static_lights), h);
+    h = hash_bytes(&light_radius, sizeof(light_radius), h);
+    h = hash_bytes(&sky_light, sizeof(sky_light), h);
+    h = hash_bytes(&settings::light_blur, sizeof(settings::light_blur), h);
+    return h;
+}
+
+std::string light_cache_path(unsigned long long key) {
+    char name[64];
+    snprintf(name, sizeof(name), "cache/lightmap_%016llx.bin", key);
+    return name;
+}
+
+//maps a matching cache file and points light_raw/lightmap at it; false if there is none or it does not match
+bool load_light_cache(unsigned long long key) {
+    const size_t bytes = sizeof(light_raw_buf) + sizeof(lightmap_buf);
+    if (!open_mapped(light_cache, light_cache_path(key))) return false;
+
+    light_cache_header* header = (light_cache_header*)light_cache.data;
+    if ((light_cache.size != sizeof(light_cache_header) + bytes) || memcmp(header->magic, "PLMC", 4) || (header->version != light_bake_version) || (header->key != key) || (header->size != bytes)) {
+        close_mapped(light_cache);
+        return false;
+    }
+    light_raw = (double(*)[map_size * 16])(light_cache.data + sizeof(light_cache_header));
+    lightmap = light_raw + map_size * 16;
+    return true;
+}
+
+void save_light_cache(unsigned long long key) {
+    std::error_code error;
+    std::filesystem::create_directories("cache", error);
+    std::ofstream file(light_cache_path(key), std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Unable to write lightmap cache: " << light_cache_path(key) << std::endl;
+        return;
+    }
+
+    light_cache_header header = { { 'P', 'L', 'M', 'C' }, light_bake_version, key, sizeof(light_raw_buf) + sizeof(lightmap_buf) };
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)light_raw, sizeof(light_raw_buf));
+    file.write((const char*)lightmap, sizeof(lightmap_buf));
+}
+
+//*********************************************************************************************************************
+
+void calculate_lights() {
+    unsigned long long key = light_cache_key();
+    close_mapped(light_cache); //back to our own buffers
+    light_raw = light_raw_buf;
+    lightmap = lightmap_buf;
+    compute_light_masks();
+    if (settings::bench_lights) benchmark_lights();
+
+    if (settings::light_cache && use_compiled_lightmap(key))
+        std::cout << "Lightmap loaded from the compiled map\n";
+    else if (settings::light_cache && load_light_cache(key))
+        std::cout << "Lightmap loaded from " << light_cache_path(key) << "\n";
+    else {
+        bake_lights_parallel(1, 1, map_size * 16, map_size * 16, light_raw, settings::threads);
+        blur_lights(0, 0, map_size * 16, map_size * 16);
+        if (settings::light_cache) save_light_cache(key);
+    }
 
     //flashlight brightness map
     for (int x = 0; x < res_X; x++)
@@ -601,6 +1406,116 @@ void calculate_lights() {
 
 }
 
+//-compilemap: loads maps/<name>.pac, bakes it and writes it with its lights, spawns and lightmap to maps/<name>.pmap
+bool compile_map(const std::string& name) {
+    gen_map_pacman(name, false);
+    calculate_lights();
+
+    std::vector<mapbin::cell> cells;
+    for (int x = 0; x < map_size; x++)
+        for (int y = 0; y < map_size; y++) cells.push_back({ map[x][y].wall, map[x][y].floor, map[x][y].ceiling, 0 });
+    std::vector<mapbin::light> lights;
+    std::vector<mapbin::spawn> spawns;
+    default_map_extras(lights, spawns);
+
+    std::string path = "maps/" + ((name != "D") ? name : std::string("default")) + ".pmap";
+    if (!mapbin::write(path, map_size, map_size, cells, lights, spawns, &light_raw[0][0], &lightmap[0][0], light_cache_key())) {
+        std::cerr << "Unable to write compiled map: " << path << std::endl;
+        return false;
+    }
+    std::cout << "Compiled map written to " << path << "\n";
+    return true;
+}
+
+//*********************************************************************************************************************
+// 										Incremental lightmap rebake
+//*********************************************************************************************************************
+
+//a map square changed occlusion (door opened/closed); schedule rebake of everything lit by lights that can see it
+void request_light_rebake(int mcx, int mcy) {
+    int x0 = map_size * 16, y0 = map_size * 16, x1 = 0, y1 = 0;
+
+    for (int i = 0; i < max_lights; i++)
+        if ((static_lights[i][2] != 0) && (fabs(mcx + 0.5 - static_lights[i][0]) < light_radius + 1) && (fabs(mcy + 0.5 - static_lights[i][1]) < light_radius + 1)) {
+            //lightmap texels this light can reach
+            int lx0 = 16 * (int)(static_lights[i][0] - light_radius - 1), lx1 = 16 * (int)(static_lights[i][0] + light_radius + 2);
+            int ly0 = 16 * (int)(static_lights[i][1] - light_radius - 1), ly1 = 16 * (int)(static_lights[i][1] + light_radius + 2);
+            if (lx0 < x0) x0 = lx0;
+            if (ly0 < y0) y0 = ly0;
+            if (lx1 > x1) x1 = lx1;
+            if (ly1 > y1) y1 = ly1;
+            compute_light_mask(i); //visibility changed; lights out of range cannot see the square
+        }
+    if (x0 < 1) x0 = 1;
+    if (y0 < 1) y0 = 1;
+    if (x1 > map_size * 16) x1 = map_size * 16;
+    if (y1 > map_size * 16) y1 = map_size * 16;
+    if ((x0 >= x1) || (y0 >= y1)) return; //no light sees this square
+
+    if (light_rebake.active) { //merge with the pending rebake; rows done so far may be stale, so start over
+        if (light_rebake.x0 < x0) x0 = light_rebake.x0;
+        if (light_rebake.y0 < y0) y0 = light_rebake.y0;
+        if (light_rebake.x1 > x1) x1 = light_rebake.x1;
+        if (light_rebake.y1 > y1) y1 = light_rebake.y1;
+    }
+    light_rebake.x0 = x0;
+    light_rebake.y0 = y0;
+    light_rebake.x1 = x1;
+    light_rebake.y1 = y1;
+    light_rebake.row = x0;
+    light_rebake.active = 1;
+}
+
+//a door finished opening or started closing: relight around it and let pathfinding know
+void door_changed(int mcx, int mcy) {
+    update_cell_bits(mcx, mcy); //first: the rebake's light masks read solid
+    request_light_rebake(mcx, mcy);
+    pathfinder.set_walkable(mcx, mcy, !square_blocked(mcx, mcy));
+    map_version++;
+}
+
+//turns door d around (the use key); a door that was standing still starts moving
+void toggle_door(int d) {
+    doors[d].dir = -doors[d].dir;
+    if (!doors[d].moving) {
+        doors[d].moving = 1;
+        moving_doors.push_back(d);
+    }
+}
+
+//moves every moving door one frame; doors that got all the way open or closed leave the list, so idle doors cost nothing
+void animate_doors() {
+    size_t kept = 0;
+    for (int d : moving_doors) {
+        door_t& door = doors[d];
+        int was_open = (door.frame >= 32);
+        if ((door.dir == 1) && (door.frame > 0)) door.frame--; //door closing
+        if ((door.dir == -1) && (door.frame < 32)) door.frame++; //door opening
+        if (was_open != (door.frame >= 32)) door_changed(door.x, door.y); //door let light/ghosts through or blocked them
+        if ((door.dir == 1) ? (door.frame > 0) : (door.frame < 32)) moving_doors[kept++] = d;
+        else door.moving = 0;
+    }
+    moving_doors.resize(kept);
+}
+
+//called once per frame; bakes a few rows into the staging buffer and swaps the region in when it is finished
+void update_light_rebake() {
+    if (!light_rebake.active) return;
+
+    int row1 = light_rebake.row + light_rebake_rows;
+    if (row1 > light_rebake.x1) row1 = light_rebake.x1;
+    bake_lights(light_rebake.row, light_rebake.y0, row1, light_rebake.y1, light_stage);
+    light_rebake.row = row1;
+
+    if (light_rebake.row == light_rebake.x1) { //done - swap in the new region all at once
+        for (int x = light_rebake.x0; x < light_rebake.x1; x++)
+            for (int y = light_rebake.y0; y < light_rebake.y1; y++)
+                light_raw[x][y] = light_stage[x][y];
+        blur_lights(light_rebake.x0, light_rebake.y0, light_rebake.x1, light_rebake.y1);
+        light_rebake.active = 0;
+    }
+}
+
 //*********************************************************************************************************************
 // 										Initialization - lookup tables
 //*********************************************************************************************************************
@@ -614,23 +1529,109 @@ void init_math() //initialization, precalculation
     for (int i = 0; i < res_X; i++) fisheye[i] = cos(0.1 * (i - res_X / 2) * torad * fov / res_X);
 
     for (int i = 0; i < 8 * res_X; i++) gausstab[i] = exp(-1.0 * ((5.0 * i / res_X) * (5.0 * i / res_X))); //gaussian, 5 sigma width
+
+    for (int i = 0; i < 8; i++) { //directions enemies steer in
+        flow_dirs[i][0] = cos(i * M_PI / 4);
+        flow_dirs[i][1] = sin(i * M_PI / 4);
+    }
     
 }
 
+//*********************************************************************************************************************
+// 										Cameras
+//*********************************************************************************************************************
+//Every frame is drawn by one or more cameras, each into its own viewport of the character buffers (split-screen,
+//spectator or debug views). The view passes below only do a camera's own rays and shading; whatever does not depend
+//on the camera is worked out once per frame in prepare_frame() and shared.
+struct camera_t {
+    double x, y, z; //eye position; z is a height like player.z
+    double ang_h; //heading, in 0.1 degrees
+    int horizon; //horizon offset in characters, like horizon_pos
+    double flashlight; //flashlight strength on this view (player.battery * light_flashlight for the player)
+    int x0, y0, w, h; //viewport in the character buffers; w at most res_X
+};
+std::vector<camera_t> cameras; //views drawn this frame; cameras[0] is the player
+
+//shared by all views of a frame
+std::vector<double> enemy_light; //per enemy: sprite brightness from the global light and the lightmap under it
+double anim_phase; //water/animated floor phase
+
+//the player's view and, with -views N, N - 1 spectator views of ghosts 0, 1, ...; side by side, or 2 x 2 for 4. A
+//view whose ghost slot is empty or freed shows the player instead
+void setup_cameras() {
+    int n = settings::views;
+    if (n < 1) n = 1;
+    if (n > 4) n = 4;
+    int cols = (n == 4) ? 2 : n, rows = (n == 4) ? 2 : 1;
+    int w = res_X / cols, h = res_Y / rows;
+
+    cameras.resize(n);
+    for (int v = 0; v < n; v++) {
+        camera_t& cam = cameras[v];
+        cam.x0 = (v % cols) * w;
+        cam.y0 = (v / cols) * h;
+        cam.w = w;
+        cam.h = h;
+        int ghost = v - 1;
+        if ((v == 0) || (ghost >= enemies.count) || (enemies.enabled[ghost] != 1)) { //the player; also stands in for ghosts that do not exist or were shot
+            cam.x = player.x;
+            cam.y = player.y;
+            cam.z = player.z;
+            cam.ang_h = player.ang_h;
+            cam.horizon = horizon_pos;
+            cam.flashlight = player.battery * light_flashlight;
+        }
+        else { //a ghost's eyes, looking where it is going
+            cam.x = enemies.x[ghost];
+            cam.y = enemies.y[ghost];
+            cam.z = 0;
+            double heading = atan2(enemies.vy[ghost], enemies.vx[ghost]) * todeg * 10;
+            cam.ang_h = (heading < 0) ? heading + 3600 : heading;
+            cam.horizon = 0;
+            cam.flashlight = 0;
+        }
+    }
+}
+
+//the camera-independent part of a frame
+void prepare_frame() {
+    enemy_light.resize(enemies.x.size());
+    for (int i = 0; i < enemies.count; i++)
+        if (enemies.enabled[i] == 1) enemy_light[i] = 32 * light_global + 16 * lightmap[(int)(16 * enemies.x[i])][(int)(16 * enemies.y[i])];
+    anim_phase = (0.5 + 0.5 * sin(1.0 * g_time / 100.0));
+}
+
+void cast(const camera_t& cam);
+void draw(const camera_t& cam);
+void draw_enemies(const camera_t& cam);
+void draw_projectiles(const camera_t& cam);
+
+//draws every camera into its viewport; the passes reuse the column buffers, so views are drawn one after another
+void render_views() {
+    setup_cameras();
+    prepare_frame();
+    for (const camera_t& cam : cameras) {
+        cast(cam);
+        draw(cam);
+        draw_enemies(cam);
+        draw_projectiles(cam);
+    }
+}
+
 //*********************************************************************************************************************
 // 										Ray Casting
 //*********************************************************************************************************************
 
-void cast() //main ray casting function
+void cast(const camera_t& cam) //main ray casting function
 {
     //some speedup might be possible by declaring all variables beforehand here instead of inside the loops
     long doornum;
     int dr;
-    for (int xs = 0; xs < res_X; xs++) //go through all screen columns
+    for (int xs = 0; xs < cam.w; xs++) //go through all viewport columns
     {
-        //ray angle = player angle +-half of FoV at screen edges; 
+        //ray angle = camera angle +-half of FoV at viewport edges; 
         //add 360 degrees to avoid negative values when using lookup table later
-        int r_angle = (int)(3600 + player.ang_h + (xs - res_X / 2) * fov / res_X);
+        int r_angle = (int)(3600 + cam.ang_h + (xs - cam.w / 2) * fov / cam.w);
 
         //ray has a velocity of 1. Now we calculate its horizontal and vertical components; 
         //horizontal uses cosine (e.g. sin(a+90 degrees))
@@ -645,8 +1646,8 @@ void cast() //main ray casting function
 
         //initial position of the ray; precise and integer values
         //ray starts from player position; tracing is done on doubles (x,y), map checks on integers(ix,iy)
-        double r_x = player.x;
-        double r_y = player.y;
+        double r_x = cam.x;
+        double r_y = cam.y;
         int r_ix = (int)r_x;
         int r_iy = (int)r_y;
         double r_dist = 0; //travelled distance
@@ -655,7 +1656,8 @@ void cast() //main ray casting function
 
         //ray tracing; we check only intersections with horizontal/vertical grid lines, so maximum of 2*map_size is possible
         for (int i = 0; i < 2 * (map_size - 1); i++) {
-            if ((map[r_ix][r_iy] % 256 > 0) && (map[r_ix][r_iy] % 256 < 200)) break; //map>0 is a wall; hit a wall? end tracing 200=horizontal door
+            int special = door_bits.test(r_ix, r_iy); //door squares are traced through in halves below
+            if (!special && solid.test(r_ix, r_iy)) break; //hit a wall? end tracing
 
             //calculate time to intersect next vertical grid line; 
             //distance to travel is the difference between double and int coordinate, +1 if moving to the right 
@@ -667,22 +1669,25 @@ void cast() //main ray casting function
 
             dr = 0;
 
-            if (map[r_ix][r_iy] % 256 == 202) {
-                typemap[xs] = 63;
-                t2 = t2 / 2.0;
-                t1 = t1 / 2.0;
-            }
+            if (special) {
+                int wall = map[r_ix][r_iy].wall;
+                if (wall == 202) {
+                    typemap[xs] = 63;
+                    t2 = t2 / 2.0;
+                    t1 = t1 / 2.0;
+                }
 
-            if ((map[r_ix][r_iy] % 256 == 200)) {
-                t2 = t2 / 2.0;
-                if (t1 > t2) dr = 1;
-                doornum = map[r_ix][r_iy] >> 24;
-            } //special case-horizontal door
-            if ((map[r_ix][r_iy] % 256 == 201)) {
-                t1 = t1 / 2.0;
-                if (t1 < t2) dr = 1;
-                doornum = map[r_ix][r_iy] >> 24;
-            } //special case-vertical door
+                if (wall == 200) {
+                    t2 = t2 / 2.0;
+                    if (t1 > t2) dr = 1;
+                    doornum = door_index[r_ix][r_iy];
+                } //special case-horizontal door
+                if (wall == 201) {
+                    t1 = t1 / 2.0;
+                    if (t1 < t2) dr = 1;
+                    doornum = door_index[r_ix][r_iy];
+                } //special case-vertical door
+            }
 
             //now we select the lower of two times, e.g. the closest intersection
             if (t1 < t2) { //intersection with vertical line
@@ -701,15 +1706,15 @@ void cast() //main ray casting function
             if (dr == 1) //door visibility check to stop the tracing
             {
                 tmap[xs] = (t1 < t2) ? 32 * fabs(r_y - (int)(r_y)) : 32 * fabs(r_x - (int)(r_x)); //calculate texture coordinate - needed for partially open door
-                if (tmap[xs] > (mapanims[doornum][1] - 1)) break; //4th map byte = door animation index (map[mx][my]/16777216)
+                if (tmap[xs] > (doors[doornum].frame - 1)) break; //past the open part of the door
             }
         }
         //end of tracing; the distance is updated during steps, so there is no need to calculate it
 
-        hmap[xs] = (int)(res_Y / 2 / r_dist / fisheye[xs]); //record wall height (~1/distance) apply fisheye correction term
-        h_clamp = 1.0 * hmap[xs] / res_Y;
+        hmap[xs] = (int)(cam.h / 2 / r_dist / fisheye[xs * res_X / cam.w]); //record wall height (~1/distance) apply fisheye correction term
+        h_clamp = 1.0 * hmap[xs] / cam.h;
         if (h_clamp > 2) h_clamp = 2;
-        typemap[xs] = map[r_ix][r_iy] % 256 - 1; //record the wall type; subtract 1 so map[x][y]=1 means wall type 0
+        typemap[xs] = map[r_ix][r_iy].wall - 1; //record the wall type; subtract 1 so wall 1 means wall type 0
         tmap[xs] = (t1 < t2) ? 32 * fabs(r_y - (int)(r_y)) : 32 * fabs(r_x - (int)(r_x)); //record the texture coordinate (fractional part of x/y coordinate * texture size)
         lmap[xs] = (t1 < t2) ? fabs(r_vx) : fabs(r_vy); //lighting based on ray normal
         lmap[xs] *= 15.0 * light_global * (light_faloff * h_clamp + 1 - light_faloff); //calculate brightness; it is proportional to height, 15.0 is arbitrary constant
@@ -719,7 +1724,7 @@ void cast() //main ray casting function
         walldmap[xs] = r_dist;
         if (dr == 1) {
             typemap[xs] = 63;
-            tmap[xs] = (t1 < t2) ? (int)(32 + 32 * fabs(r_y - (int)(r_y)) - mapanims[doornum][1]) % 32 : (int)(32 + 32 * fabs(r_x - (int)(r_x)) - mapanims[doornum][1]) % 32;
+            tmap[xs] = (t1 < t2) ? (int)(32 + 32 * fabs(r_y - (int)(r_y)) - doors[doornum].frame) % 32 : (int)(32 + 32 * fabs(r_x - (int)(r_x)) - doors[doornum].frame) % 32;
         } //door - last texture no 63
     }
 }
@@ -729,21 +1734,22 @@ void cast() //main ray casting function
 //*********************************************************************************************************************
 
 
-void draw_projectiles()
+void draw_projectiles(const camera_t& cam)
 {
     int hor_pos, column, kk, cx, cy, fkk, fkc;
     double ang0, ang1;
     double dx, dy, dx2, dy2;
     double dst, scale;
+    double zoom = 1.0 * cam.h / res_Y; //sprite size relative to a full-screen view
 
-    for (int i = 0; i < 64; i++)
-        if (projectiles[i][4])
+    for (int i = 0; i < max_projectiles; i++)
+        if (projectiles.type[i])
         {
-            ang0 = player.ang_h / 10.0; //in degrees
-            hor_pos = (int)player.ang_v;
+            ang0 = cam.ang_h / 10.0; //in degrees
+            hor_pos = cam.horizon;
 
-            dx = projectiles[i][0] - player.x;
-            dy = projectiles[i][1] - player.y;
+            dx = projectiles.x[i] - cam.x;
+            dy = projectiles.y[i] - cam.y;
             dx2 = cos(ang0 * torad);
             dy2 = sin(ang0 * torad);
 
@@ -754,27 +1760,28 @@ void draw_projectiles()
             dst = sqrt(dx * dx + dy * dy) / 2;
 
             if (dst > 0.1) {
-                scale = 32 / dst;
-                column = (int)(res_X * (ang1) / (0.1 * fov));
+                scale = 32 / dst * zoom;
+                column = (int)(cam.w * (ang1) / (0.1 * fov));
 
                 int ptype = 0;
-                if (projectiles[i][4] == 2)ptype = 1024 * 3;
-                if (projectiles[i][4] == 1)ptype = 1024 * 4; //sprite off. will be stored in proj. data later
+                if (projectiles.type[i] == 2)ptype = 1024 * 3;
+                if (projectiles.type[i] == 1)ptype = 1024 * 4; //sprite off. will be stored in proj. data later
 
-                if (column > -res_X && column < res_X && scale < 128)
+                if (column > -cam.w && column < cam.w && scale < 128)
                     for (int x = 0; x < scale; x++)
                         for (int y = 0; y < scale; y++)
                         {
                             kk = sprites2[(int)(32.0 * x / scale) + 32 * (int)(32.0 * y / scale) + ptype];
-                            cx = (int)(res_X / 2 - scale / 2 + x + column);
-                            cy = (int)(res_Y / 2 - scale / 2 + y - hor_pos);
-                            if ((kk > 0) && (cy < res_Y) && (cy > 0) && (cx < res_X) && (cx > 0) && (depth_map[cx + cy * res_X] > 2 * dst))
+                            cx = (int)(cam.w / 2 - scale / 2 + x + column);
+                            cy = (int)(cam.h / 2 - scale / 2 + y - hor_pos);
+                            int off = cam.x0 + cx + (cam.y0 + cy) * res_X; //in the character buffers
+                            if ((kk > 0) && (cy < cam.h) && (cy > 0) && (cx < cam.w) && (cx > 0) && (depth_map[off] > 2 * dst))
                             {
                                 fkk = kk % 256;
                                 if (fkk > 12)fkk = 12; if (fkk < 0)fkk = 0;
-                                char_buff[cx + cy * res_X] = char_grad[fkk];
-                                color_buff[cx + cy * res_X] = pal[kk / 256][0];
-                                depth_map[cx + cy * res_X] = 2 * dst;
+                                char_buff[off] = char_grad[fkk];
+                                color_buff[off] = pal[kk / 256][0];
+                                depth_map[off] = 2 * dst;
                             }
                         }
             }//end of distance check
@@ -782,7 +1789,7 @@ void draw_projectiles()
 }
 
 
-void draw() {
+void draw(const camera_t& cam) {
     //int off; //offset in the 1-d char/color buffer we are writing to 
     int lm1, lm2, ang; //upper/lower limit of the wall slice; ray angle
     int crdx, crdy, crd, mcx, mcy; //texture x,y coordinate, final coordinate in 1-d texture buffer, max x,y coordinate of floor/ceiling pixel
@@ -794,29 +1801,30 @@ void draw() {
     double fbump; //for floor/ceiling bump mapping
     double plusrefl;
 
-    double anim_phase = (0.5 + 0.5 * sin(1.0 * g_time / 100.0));
-    //go through the screen, column by column
-    for (int x = 0; x < res_X; x++) {
-        int plusy = (int)(-player.z * (hmap[x] + 1)); //player vertical pos modifier
-        //upper limit of the wall, capped at half vertical resolution (middle of the screen=0)
-        int lm1 = -((hmap[x] + horizon_pos + plusy) > res_Y / 2 ? res_Y / 2 : (hmap[x] + horizon_pos + plusy));
-        //lower limit of the wall, capped at -half vertical resolution (middle of the screen=0)
-        int lm2 = ((hmap[x] - horizon_pos - plusy + 1) > res_Y / 2 ? res_Y / 2 : (hmap[x] - horizon_pos - plusy + 1));
+    int horizon_pos = cam.horizon; //this view's horizon
+    //go through the viewport, column by column
+    for (int x = 0; x < cam.w; x++) {
+        int plusy = (int)(-cam.z * (hmap[x] + 1)); //player vertical pos modifier
+        //upper limit of the wall, capped at half vertical resolution (middle of the viewport=0)
+        int lm1 = -((hmap[x] + horizon_pos + plusy) > cam.h / 2 ? cam.h / 2 : (hmap[x] + horizon_pos + plusy));
+        //lower limit of the wall, capped at -half vertical resolution (middle of the viewport=0)
+        int lm2 = ((hmap[x] - horizon_pos - plusy + 1) > cam.h / 2 ? cam.h / 2 : (hmap[x] - horizon_pos - plusy + 1));
+        int fx = x * res_X / cam.w; //flashlight_coeff column; the flashlight map is for a full-screen view
 
         //array offset for putting characters
-        int offset = x; //we draw on the column x
+        int offset = cam.x0 + x + cam.y0 * res_X; //we draw on the column x of the viewport
         double character; //the number of the character from gradient to draw
         int color; //the color of the character to draw
         double normal; //texture normal
         int iswall; //on/off flag if we are drawing a wall. Needed for depth map
         double bmpc[2]; //for bump mapping
-        int r_angle = (int)(3600 + player.ang_h + (x - res_X / 2) * fov / res_X); //ray angle, needed for normal maps
+        int r_angle = (int)(3600 + cam.ang_h + (x - cam.w / 2) * fov / cam.w); //ray angle, needed for normal maps
         double r_vx = sintab[(r_angle + 900) % 3600]; //ray step x
         double r_vy = sintab[r_angle % 3600]; //ray step y
-        double anim_phase = (0.5 + 0.5 * sin(1.0 * g_time / 100.0));
-        for (int y = -res_Y / 2; y < res_Y / 2; y++) //go along the whole screen column, drawing either wall or floor/ceiling
+        for (int y = -cam.h / 2; y < cam.h / 2; y++) //go along the whole viewport column, drawing either wall or floor/ceiling
         {
-            int ang = (int)(3600 + player.ang_h + (x - res_X / 2) * fov / res_X); //calculate ray angle; needed for floor
+            int ang = r_angle; //ray angle; needed for floor
+            int fy = (y + cam.h / 2) * res_Y / cam.h; //flashlight_coeff row
             double dx = sintab[(ang + 900) % 3600]; //steps in x and y direction, the same as in tracing, needed for floor
             double dy = sintab[ang % 3600];
             character = 0;
@@ -833,29 +1841,29 @@ void draw() {
                 character += ((abs(y) % 2) + (abs(x) % 2)); //add dithering to avoid ugly edges
                 character = character * lmap[x]; //multiply by the brightness value of 1-d light map
                 character += lightmap[(int)(16 * wallxmap[x])][(int)(16 * wallymap[x])]; //apply 2-D lightmap
-                character += player.battery * light_flashlight * flashlight_coeff[x + (y + res_Y / 2) * res_X] * hmap[x] / res_Y * lmap[x]; //flashlight
+                character += cam.flashlight * flashlight_coeff[fx + fy * res_X] * hmap[x] / cam.h * lmap[x]; //flashlight
                 character *= (nmap[x] * (fabs(r_vx) + r_vy * normal) + (1 - nmap[x]) * (fabs(r_vy) + r_vx * normal)); //apply texture normals
             }
             else //floor/ceiling?
             {
                 iswall = 0;
                 double plusy2;
-                (y + horizon_pos > 0) ? plusy2 = 32.0 * player.z : plusy2 = -32.0 * player.z; //player height modif.
+                (y + horizon_pos > 0) ? plusy2 = 32.0 * cam.z : plusy2 = -32.0 * cam.z; //player height modif.
                 //calculate distance to the floor pixel; y and horizon_pos are in pixels, 0.1 is added here to avoid division by 0
-                double dz = (res_Y / 2 + plusy2) / (fabs(y + horizon_pos) + 0.0) / fisheye[x];
+                double dz = (cam.h / 2 + plusy2) / (fabs(y + horizon_pos) + 0.0) / fisheye[fx];
                 if ((dz < 16) && (dz > 0)) //ignore extremely far things
                 {
-                    int crdx = (int)(1024 + 32.0 * (player.x + dx * dz)) % 32; //floor/ceiling texture coordinates
-                    int crdy = (int)(1024 + 32.0 * (player.y + dy * dz)) % 32; //1024 is here just to avoid negative numbers
-                    int mcx = (int)(player.x + dx * dz) % map_size; //floor/ceiling map coordinates
-                    int mcy = (int)(player.y + dy * dz) % map_size;
+                    int crdx = (int)(1024 + 32.0 * (cam.x + dx * dz)) % 32; //floor/ceiling texture coordinates
+                    int crdy = (int)(1024 + 32.0 * (cam.y + dy * dz)) % 32; //1024 is here just to avoid negative numbers
+                    int mcx = (int)(cam.x + dx * dz) % map_size; //floor/ceiling map coordinates
+                    int mcy = (int)(cam.y + dy * dz) % map_size;
                     int crd = crdx + 32 * crdy; //base texture coordinate
-                    if (y > (-horizon_pos)) crd += 1024 * ((map[mcx][mcy] / 256) % 256); //2nd byte = floor type
-                    else crd += 1024 * ((map[mcx][mcy] / 65536) % 256); //3rd byte = ceiling type
+                    if (y > (-horizon_pos)) crd += 1024 * map[mcx][mcy].floor;
+                    else crd += 1024 * map[mcx][mcy].ceiling;
 
                     /*
                     //special case-water
-                    if ((y > -horizon_pos) && (((map[mcx][mcy] / 256) % 256) == 3)) cha = anim_phase * (textures[crd] % 256) + (1 - anim_phase) * (textures[crd + 1024] % 256);
+                    if ((y > -horizon_pos) && (map[mcx][mcy].floor == 3)) cha = anim_phase * (textures[crd] % 256) + (1 - anim_phase) * (textures[crd + 1024] % 256);
                     bmpc[g_time % 2] = character;
                     color = (textures[crd] / 256) % 256; //get texture color (2nd byte)
                     character = character * 1.0 / (0.1 + 16.0 * dz); //OPTIONAL distance based brightness; change factor 2.5 for faster/slower faloff; factor 0.1 is to avoid division by 0 if dz=0
@@ -864,17 +1872,17 @@ void draw() {
                     //static lights
                     //cha = cha + lightmap[(int)(16 * (player.x + dx * dz))][(int)(16 * (player.y + dy * dz))] * (1.0 + 0.01 * maprandoms[0]);
 
-                    if (((map[mcx][mcy] / 65536) > 0) || (y > (-horizon_pos))) //ground or non-sky?
+                    if ((map[mcx][mcy].ceiling > 0) || (y > (-horizon_pos))) //ground or non-sky?
                     {
                         character = textures[crd] % 256; //get texture pixel (1st byte)
                         color = (textures[crd] / 256) % 256; //get texture color (2nd byte)
                         character += ((abs(y) % 2) + (abs(x) % 2)); //add dithering
                         character *= 0.2 * light_global * (light_faloff * abs(y + horizon_pos) / (dz + 1) + 1 - light_faloff); //distance-based gradient
                         //character+=lightmap[(int)(16*(player.x+dx*dz))][(int)(16*(player.y+dy*dz))]; //apply 2-D lightmap
-                        character += 0.2 * (player.battery * light_flashlight * flashlight_coeff[x + (y + res_Y / 2) * res_X] / (dz + 2)); //flashlight
+                        character += 0.2 * (cam.flashlight * flashlight_coeff[fx + fy * res_X] / (dz + 2)); //flashlight
                     }
                     else {
-                        character = sky[(res_X * 2 * res_Y + x / 8 + (int)(r_angle / 8) + (y + res_Y / 2 + horizon_pos) * 2 * res_X) % (res_X * res_Y)];
+                        character = sky[(res_X * 2 * res_Y + fx / 8 + (int)(r_angle / 8) + (fy + horizon_pos) * 2 * res_X) % (res_X * res_Y)];
                         character += ((abs(y) % 2) + (abs(x) % 2)); //add dithering 
                         color = sky_color;
                     }
@@ -918,7 +1926,7 @@ void draw_sprite(int pos, int number, int which) //draw a sprite at specific poi
 }
 
 //*********************************************************************************************************************
-void draw_enemies() {
+void draw_enemies(const camera_t& cam) {
     int charn, color; //character number and color value to draw
     //helper variables for calculating various distances and angles
     int column, cx, cy; //screen column of sprite center, x,y coordinates to draw to
@@ -927,49 +1935,66 @@ void draw_enemies() {
     double dst, scale; //distance and sprite scale
     double brightness; //brightness modifier for drawing sprite
 
-    for (int i = 0; i < 16; i++)
-        if (enemies[i].enabled == 1) {
-            ang0 = player.ang_h / 10.0; //player angle, in degrees
+    double zoom = 1.0 * cam.h / res_Y; //sprite size relative to a full-screen view
+
+    //visit enemy_grid cells that can overlap the view; sprites are drawn when within fov/10 degrees of the heading
+    ang0 = cam.ang_h / 10.0; //camera angle, in degrees
+    dx2 = cos(ang0 * torad); //player heading vector
+    dy2 = sin(ang0 * torad);
+    double cell_r = enemy_grid.cell * 0.7072; //cell circumradius
+    for (int c = 0; c < enemy_grid.cols * enemy_grid.rows; c++) {
+        if (enemy_grid.start[c] == enemy_grid.start[c + 1]) continue; //empty
+        dx = ((c % enemy_grid.cols) + 0.5) * enemy_grid.cell - cam.x;
+        dy = ((c / enemy_grid.cols) + 0.5) * enemy_grid.cell - cam.y;
+        dst = sqrt(dx * dx + dy * dy);
+        if (dst > cell_r) {
+            ang1 = atan2(dx2 * dy - dy2 * dx, dx2 * dx + dy2 * dy) * todeg; //player to cell angle, degrees
+            if (fabs(ang1) - asin(cell_r / dst) * todeg >= 0.1 * fov) continue; //whole cell outside the view
+        }
 
-            dx = enemies[i].x - player.x; //x,y distance to enemy
-            dy = enemies[i].y - player.y;
-            dx2 = cos(ang0 * torad); //player heading vector
-            dy2 = sin(ang0 * torad);
+        for (int k = enemy_grid.start[c]; k < enemy_grid.start[c + 1]; k++) {
+            int i = enemy_grid.items[k].id;
+            if (enemies.enabled[i] != 1) continue;
+
+            dx = enemies.x[i] - cam.x; //x,y distance to enemy
+            dy = enemies.y[i] - cam.y;
+            if ((dx == 0) && (dy == 0)) continue; //the camera is this ghost
 
             double dot = dx2 * dx + dy2 * dy; //dot product between [x1, y1] and [x2, y2]
             double det = dx2 * dy - dy2 * dx; //determinant
             ang1 = atan2(det, dot) * todeg; //player to enemy angle, degrees
 
             dst = sqrt(dx * dx + dy * dy); //distance to enemy
-            scale = 32.0 / dst; //distance-based scaling
-            column = (int)(res_X * (ang1) / (0.1 * fov)); //screen column to draw on
-            int plusy = (int)(32.0 * player.z / dst); //player vertical pos modifier
+            scale = 32.0 / dst * zoom; //distance-based scaling
+            column = (int)(cam.w * (ang1) / (0.1 * fov)); //viewport column to draw on
+            int plusy = (int)(32.0 * cam.z / dst * zoom); //player vertical pos modifier
 
-            if (column > -res_X && column < res_X && scale < 256) //we are within the screen? isn't sprite too big?
+            if (column > -cam.w && column < cam.w && scale < 256) //we are within the viewport? isn't sprite too big?
                 for (int x = 0; x < scale; x++)
                     for (int y = 0; y < scale; y++) {
-                        charn = sprites[((int)(32.0 * x / scale) + 32 * (int)(32.0 * y / scale)) % 1024 + 1024 * enemies[i].type]; //base brightness
-                        cx = (int)(res_X / 2 - scale / 2 + x + column); //coordinate x
-                        cy = (int)(res_Y / 2 - scale / 2 + y - horizon_pos + plusy); //coordinate y
-                        if ((charn / 65536 > 0) && (cy < res_Y) && (cy > 0) && (cx < res_X) && (cx > 0) && (depth_map[cx + cy * res_X] > dst)) //>0 alpha, we are within screen, not obscured (depth map)
+                        charn = sprites[((int)(32.0 * x / scale) + 32 * (int)(32.0 * y / scale)) % 1024 + 1024 * enemies.type[i]]; //base brightness
+                        cx = (int)(cam.w / 2 - scale / 2 + x + column); //coordinate x
+                        cy = (int)(cam.h / 2 - scale / 2 + y - cam.horizon + plusy); //coordinate y
+                        int off = cam.x0 + cx + (cam.y0 + cy) * res_X; //in the character buffers
+                        if ((charn / 65536 > 0) && (cy < cam.h) && (cy > 0) && (cx < cam.w) && (cx > 0) && (depth_map[off] > dst)) //>0 alpha, we are within the viewport, not obscured (depth map)
                         {
                             color = (charn / 256) % 16; //record color
 
-                            brightness = 32 * light_global; //base global value
-                            brightness += 16 * lightmap[(int)(16 * enemies[i].x)][(int)(16 * enemies[i].y)]; //apply 2-D lightmap
-                            brightness += player.battery * light_flashlight * flashlight_coeff[cx + cy * res_X]; //apply flashlight
+                            brightness = enemy_light[i]; //global light and 2-D lightmap, from prepare_frame()
+                            brightness += cam.flashlight * flashlight_coeff[cx * res_X / cam.w + (cy * res_Y / cam.h) * res_X]; //apply flashlight
                             brightness = 1E-6 * (brightness + scale * 4); //apply distance scaling coefficient
                             charn = ((int)(charn * brightness)); //final character value
                             if (charn > grad_length) charn = grad_length;
                             if (charn < 0) charn = 0; //value clamping	
-                            char_buff[cx + cy * res_X] = char_grad[charn]; //save character to buffer
-                            nchar_buff[cx + cy * res_X] = charn; //save character number to buffer
-                            color_buff[cx + cy * res_X] = pal[color][(charn > pal_thr1) + (charn > pal_thr2)]; //save color to buffer 
-                            depth_map[cx + cy * res_X] = dst; //record depth value - so sprites can obscure each other; 
+                            char_buff[off] = char_grad[charn]; //save character to buffer
+                            nchar_buff[off] = charn; //save character number to buffer
+                            color_buff[off] = pal[color][(charn > pal_thr1) + (charn > pal_thr2)]; //save color to buffer 
+                            depth_map[off] = dst; //record depth value - so sprites can obscure each other; 
                             //closer sprites will overdraw farther, farther cannot be drawn on closer due to above depth map update
                         }
                     } //end of enemy drawing	
         } //end of going through enemies
+    } //end of going through cells
 }
 //*********************************************************************************************************************
 void HUD() {
@@ -1000,84 +2025,323 @@ void post_processing() {
         for (int i = 0; i < res_X * res_Y; i++) color_buff[i] = 4; //loop through all pixels and set them to 
 }
 
+//*********************************************************************************************************************
+// 										Input recording and replay
+//*********************************************************************************************************************
+replay::recorder input_recorder; //open while recording (-record)
+replay::reader input_replay; //recording being played back (-replay)
+bool replaying = false;
+std::vector<float> frame_times; //milliseconds every game tick took, for -times
+
+//fills in this tick's input, from the keyboard and mouse or from the recording; false when the recording is over
+bool read_input(replay::frame& in) {
+    static const SDL_Scancode scancodes[12] = { SDL_SCANCODE_W, SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_SPACE,
+        SDL_SCANCODE_E, SDL_SCANCODE_F, SDL_SCANCODE_G, SDL_SCANCODE_H, SDL_SCANCODE_ESCAPE, SDL_SCANCODE_F5, SDL_SCANCODE_F9 }; //in replay::key bit order
+    SDL_PumpEvents(); //keeps the window responsive while replaying too
+    if (replaying) return input_replay.next(in);
+
+    in = replay::frame();
+    for (int k = 0; k < 12; k++)
+        if (keys[scancodes[k]]) in.keys |= 1 << k;
+    int mx, my;
+    SDL_GetMouseState(&mx, &my);
+    in.mouse_x = (short)mx;
+    in.mouse_y = (short)my;
+    in.buttons = (GetAsyncKeyState(VK_LBUTTON) & 0x8000) ? 1 : 0;
+    if (input_recorder.is_open()) input_recorder.add(in);
+    return true;
+}
+
+//hash of everything the game carries from one tick to the next; a replay that ends with the recorded hash played
+//exactly the recorded game
+unsigned long long state_hash() {
+    unsigned long long h = hash_bytes(&g_time, sizeof(g_time));
+    h = hash_bytes(&player, sizeof(player), h);
+    h = hash_bytes(&key_delay, sizeof(key_delay), h);
+    h = hash_bytes(player_anim, sizeof(player_anim), h);
+    h = hash_bytes(map, sizeof(map), h);
+    h = hash_bytes(doors.data(), doors.size() * sizeof(door_t), h);
+    h = hash_bytes(moving_doors.data(), moving_doors.size() * sizeof(int), h);
+    h = hash_bytes(enemies.x.data(), enemies.x.size() * sizeof(float), h);
+    h = hash_bytes(enemies.y.data(), enemies.y.size() * sizeof(float), h);
+    h = hash_bytes(enemies.vx.data(), enemies.vx.size() * sizeof(float), h);
+    h = hash_bytes(enemies.vy.data(), enemies.vy.size() * sizeof(float), h);
+    h = hash_bytes(enemies.hp.data(), enemies.hp.size() * sizeof(float), h);
+    h = hash_bytes(enemies.enabled.data(), enemies.enabled.size(), h);
+    h = hash_bytes(&projectiles, sizeof(projectiles), h);
+    return h;
+}
+
+//writes frame_times as CSV and prints a summary, so two builds can be compared on the same replay
+void write_frame_times(const char* path) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Unable to write frame times: " << path << std::endl;
+        return;
+    }
+    file << "tick,ms\n";
+    for (size_t i = 0; i < frame_times.size(); i++) file << i << "," << frame_times[i] << "\n";
+
+    if (frame_times.empty()) return;
+    std::vector<float> sorted = frame_times;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (float t : sorted) total += t;
+    std::cout << frame_times.size() << " ticks: mean " << total / sorted.size() << " ms, median " << sorted[sorted.size() / 2]
+        << " ms, 99th percentile " << sorted[sorted.size() * 99 / 100] << " ms, worst " << sorted.back() << " ms (" << path << ")\n";
+}
+
+//opens the -record file, if any, for a game on map
+void start_recording(const std::string& map) {
+    if (!settings::record_file) return;
+    replay::header header;
+    header.seed = settings::seed;
+    header.ghosts = settings::arena_ghosts;
+    header.lod = settings::lod ? 1 : 0;
+    strncpy(header.map, map.c_str(), sizeof(header.map) - 1);
+    if (input_recorder.open(settings::record_file, header)) std::cout << "Recording to " << settings::record_file << "\n";
+    else std::cerr << "Unable to write recording: " << settings::record_file << std::endl;
+}
+
+//end of the game: closes the recording, checks a replay against its recorded hash and writes -times
+void finish_recording() {
+    unsigned long long hash = state_hash();
+    if (input_recorder.is_open()) {
+        input_recorder.close(hash);
+        std::cout << "Recorded " << g_time << " ticks, final state hash " << std::hex << hash << std::dec << "\n";
+    }
+    if (replaying && (g_time < (int)input_replay.head.ticks))
+        std::cout << "Stopped after " << g_time << " of " << input_replay.head.ticks << " recorded ticks, state hash " << std::hex << hash << std::dec << "\n";
+    else if (replaying) {
+        std::cout << "Replayed " << g_time << " ticks, final state hash " << std::hex << hash << std::dec;
+        if (hash == input_replay.head.final_hash) std::cout << " (same as recorded)\n";
+        else std::cout << " - DIFFERENT from the recorded " << std::hex << input_replay.head.final_hash << std::dec << "\n";
+    }
+    if (settings::times_file) write_frame_times(settings::times_file);
+}
+
+//*********************************************************************************************************************
+// 										Snapshots (save/load)
+//*********************************************************************************************************************
+//Everything the game carries from one tick to the next, in one versioned blob. Caches derived from the map (path
+//fields, flow, the blocked map) are keyed by map_version and rebuild themselves; the pathfinder graph and the
+//lightmap are patched for the squares whose walls or doors differ, like when a door moves
+
+const int snapshot_version = 2; //bump whenever anything is added, removed or reordered in snapshot_fields()
+std::vector<char> quick_save; //F5 saves here (and to saves/quick.sav), F9 goes back to it
+
+struct snapshot_header {
+    char magic[4]; //"PSNP"
+    int version; //snapshot_version
+    int size; //map_size the snapshot was taken with
+};
+
+//the snapshot layout, walked by snapshot::writer to save and by snapshot::reader to restore
+template <class A>
+void snapshot_fields(A& a) {
+    a.value(settings::seed);
+    a.value(g_time);
+    a.value(player);
+    a.value(key_delay);
+    a.value(player_anim);
+    a.value(light_flashlight);
+    a.value(map);
+    a.vector(doors);
+    a.vector(moving_doors);
+
+    a.value(enemies.count);
+    a.vector(enemies.x);
+    a.vector(enemies.y);
+    a.vector(enemies.vx);
+    a.vector(enemies.vy);
+    a.vector(enemies.hp);
+    a.vector(enemies.type);
+    a.vector(enemies.enabled);
+    a.vector(enemies.lod);
+    a.vector(enemies.seen);
+    a.vector(enemies.free_slots);
+    if (A::loading) enemy_routes.resize(enemies.x.size());
+    for (route_t& r : enemy_routes) {
+        char valid = (r.version == pathfinder.version); //versions are per graph; only whether it was still good is kept
+        a.value(valid);
+        if (A::loading) r.version = valid ? pathfinder.version : -1;
+        a.value(r.goal);
+        a.vector(r.waypoints);
+        a.value(r.next);
+        a.vector(r.steps);
+        a.value(r.step);
+    }
+    //the grid as the last move left it: it still holds enemies shot since, and they push the others next tick
+    a.value(enemy_grid.cell);
+    a.value(enemy_grid.cols);
+    a.value(enemy_grid.rows);
+    a.vector(enemy_grid.start);
+    a.vector(enemy_grid.items);
+
+    a.value(projectiles);
+}
+
+void save_snapshot(std::vector<char>& out) {
+    static size_t last_size = 0; //snapshots hardly change size, so one allocation is usually enough
+    out.clear();
+    out.reserve(last_size);
+    snapshot::writer w(out);
+    snapshot_header header = { { 'P', 'S', 'N', 'P' }, snapshot_version, map_size };
+    w.value(header);
+    snapshot_fields(w);
+    last_size = out.size();
+}
+
+//puts the game back as save_snapshot() found it; false, with the game unchanged, if data is not a whole snapshot of
+//this version and map size
+bool restore_snapshot(const std::vector<char>& data) {
+    snapshot::reader r(data.data(), data.size());
+    snapshot_header header;
+    r.value(header);
+    if (!r.ok() || memcmp(header.magic, "PSNP", 4) || (header.version != snapshot_version) || (header.size != map_size)) return false;
+
+    static std::vector<char> backup; //the game as it was, in case data turns out to be broken halfway through
+    static cell_t old_map[map_size][map_size];
+    static char was_blocked[map_size][map_size];
+    save_snapshot(backup);
+    memcpy(old_map, map, sizeof(map));
+    for (int x = 0; x < map_size; x++)
+        for (int y = 0; y < map_size; y++) was_blocked[x][y] = square_blocked(x, y) ? 1 : 0;
+
+    snapshot_fields(r);
+    size_t slots = enemies.x.size();
+    bool fits = (enemies.count >= 0) && (enemies.count <= (int)slots) && (slots % 4 == 0) && (enemies.y.size() == slots) && (enemies.vx.size() == slots)
+        && (enemies.vy.size() == slots) && (enemies.hp.size() == slots) && (enemies.type.size() == slots) && (enemies.enabled.size() == slots)
+        && (enemies.lod.size() == slots) && (enemies.seen.size() == slots) && (enemy_grid.start.size() == (size_t)enemy_grid.cols * enemy_grid.rows + 1);
+    for (const door_t& d : doors) fits = fits && (d.x >= 0) && (d.x < map_size) && (d.y >= 0) && (d.y < map_size);
+    for (int d : moving_doors) fits = fits && (d >= 0) && (d < (int)doors.size());
+    if (!r.done() || !fits) {
+        std::vector<char> previous;
+        previous.swap(backup); //the next call saves into backup again
+        restore_snapshot(previous);
+        return false;
+    }
+
+    for (int x = 0; x < map_size; x++)
+        for (int y = 0; y < map_size; y++) door_index[x][y] = -1;
+    for (int d = 0; d < (int)doors.size(); d++) door_index[doors[d].x][doors[d].y] = d;
+    for (int x = 0; x < map_size; x++)
+        for (int y = 0; y < map_size; y++) update_cell_bits(x, y);
+
+    //walls and doors that differ from before: like a door moving, but for any square
+    int graph_version = pathfinder.version;
+    bool changed = false;
+    for (int x = 0; x < map_size; x++)
+        for (int y = 0; y < map_size; y++)
+            if (memcmp(&map[x][y], &old_map[x][y], sizeof(cell_t)) || (was_blocked[x][y] != (square_blocked(x, y) ? 1 : 0))) {
+                request_light_rebake(x, y);
+                pathfinder.set_walkable(x, y, !square_blocked(x, y));
+                changed = true;
+            }
+    if (changed) map_version++;
+    for (route_t& route : enemy_routes) //the routes were good for the restored map, which the graph now matches again
+        if (route.version == graph_version) route.version = pathfinder.version;
+    return true;
+}
+
+void save_snapshot_file(const std::string& path, const std::vector<char>& data) {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    std::ofstream file(path, std::ios::binary);
+    if (file.is_open()) file.write(data.data(), data.size());
+    else std::cerr << "Unable to write saved game: " << path << std::endl;
+}
+
+bool load_snapshot_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (restore_snapshot(data)) return true;
+    std::cerr << "Unable to load saved game: " << path << std::endl;
+    return false;
+}
+
 //*********************************************************************************************************************
 // 										Controls (windows-specific)
 //*********************************************************************************************************************
-void controls() //handles keyboard, mouse controls and player movement; windows-specific
+void controls(const replay::frame& in) //handles keyboard, mouse controls and player movement; windows-specific
 {
-    SDL_PumpEvents();
     int interx, intery; //map coordinate player is interacting with
     double accel = player.accel * (1.0 / 150 * player.stamina);
     double dx = accel * sintab[(int)player.ang_h % 3600]; //x step in the direction player is looking; 
     double dy = accel * sintab[((int)player.ang_h + 900) % 3600]; //y step in the direction player is looking
 
     if (player.hp >= 0.5) {
-        if (keys[SDL_SCANCODE_A]) {
+        if ((in.keys & replay::key_a)) {
             player.vx += dx / 2;
             player.vy -= dy / 2;
         }; //WASD movement
-        if (keys[SDL_SCANCODE_D]) {
+        if ((in.keys & replay::key_d)) {
             player.vx -= dx / 2;
             player.vy += dy / 2;
         };
-        if (keys[SDL_SCANCODE_W]) {
+        if ((in.keys & replay::key_w)) {
             player.vx += dy;
             player.vy += dx;
         };
-        if (keys[SDL_SCANCODE_S]) {
+        if ((in.keys & replay::key_s)) {
             player.vx -= dy / 2;
             player.vy -= dx / 2;
         };
 
-        if (keys[SDL_SCANCODE_F] && (key_delay < 0.1)) {
+        if ((in.keys & replay::key_f) && (key_delay < 0.1)) {
             light_flashlight = (1 - light_flashlight);
             key_delay = 1;
         }; //F for flashlight
 
-        if (keys[SDL_SCANCODE_G] && (key_delay < 0.1)) {
+        if ((in.keys & replay::key_g) && (key_delay < 0.1)) {
             player.status[1] = (1 - player.status[1]);
             key_delay = 1;
         }; //g for god mode
 
-        if (keys[SDL_SCANCODE_SPACE] && (player.z < 0.05)) {
+        if ((in.keys & replay::key_space) && (player.z < 0.05)) {
             player.vz = player.jump_h;
         }; //space for jump
-        if (keys[SDL_SCANCODE_E] && (key_delay < 0.1)) {//use key
+        if ((in.keys & replay::key_e) && (key_delay < 0.1)) {//use key
             interx = (int)(player.x + 150 * dy);
             intery = (int)(player.y + 150 * dx);
 
-            int dooraction;
-            long doornum = map[interx][intery] >> 24;
-
-            if (map[interx][intery] % 256 == 200)//horizontal door
+            if (map[interx][intery].wall == 200)//horizontal door
             {
-                dooraction = mapanims[doornum][0];
-                mapanims[doornum][0] = -dooraction; //1=opening, -1=closing
+                toggle_door(door_index[interx][intery]);
                 //std::cout << "Interact\n";
             }
 
-            if (map[interx][intery] % 256 == 201)//vertical door
+            if (map[interx][intery].wall == 201)//vertical door
             {
-                dooraction = mapanims[doornum][0];
-                mapanims[doornum][0] = -dooraction; //1=opening, -1=closing
+                toggle_door(door_index[interx][intery]);
             }
             key_delay = 1;
         }//end use key
     }
 
-    if (keys[SDL_SCANCODE_ESCAPE]) F_exit = 1; //esc for exit
+    if ((in.keys & replay::key_escape)) F_exit = 1; //esc for exit
 
-    if (keys[SDL_SCANCODE_H] && (key_delay < 0.1)) {
+    if ((in.keys & replay::key_h) && (key_delay < 0.1)) {
         debug[0] = (debug[0] + 1) % 3;
         key_delay = 1;
     } //h for toggling display type
 
+    if ((in.keys & replay::key_f5) && (key_delay < 0.1)) {
+        key_delay = 1; //before saving, so loading does not trigger again right away
+        save_snapshot(quick_save);
+        if (!replaying) save_snapshot_file("saves/quick.sav", quick_save); //a replay only needs it in memory, for F9
+    } //F5 quick save
+    if ((in.keys & replay::key_f9) && (key_delay < 0.1) && !quick_save.empty()) {
+        restore_snapshot(quick_save);
+        key_delay = 1;
+    } //F9 quick load
+
     key_delay *= 0.9; //delay so that toggle buttons (like flashlight) do not trigger 100x per second
 
     mousex0 = P_Res_X / 2;
     mousey0 = P_Res_Y / 2;
-    Uint32 mbuttons;
-    mbuttons = SDL_GetMouseState(&mousex, &mousey);
+    mousex = in.mouse_x;
+    mousey = in.mouse_y;
     player.ang_h = 500.0 * (mousex - mousex0) / mouse_speed;
     player.ang_v = 20.0 * (mousey - mousey0) / mouse_speed;
 
@@ -1090,16 +2354,9 @@ void controls() //handles keyboard, mouse controls and player movement; windows-
 
     if (player.ang_h < 3600) player.ang_h += 3600; //if player angle is less than 360 degrees, add 360 degrees so its never negative
 
-    if ((GetAsyncKeyState(VK_LBUTTON) & 0x8000) && (key_delay < 0.1)) //shot
+    if ((in.buttons & 1) && (key_delay < 0.1)) //shot
     {
-        projectiles[num_projectile][0] = player.x;
-        projectiles[num_projectile][1] = player.y;
-        projectiles[num_projectile][2] = 32 * dy;
-        projectiles[num_projectile][3] = 32 * dx;
-        projectiles[num_projectile][4] = 1;
-        projectiles[num_projectile][5] = 1;
-        projectiles[num_projectile][6] = num_projectile % 8;
-        num_projectile = (num_projectile + 1) % 64;
+        spawn_projectile(player.x, player.y, 32 * dy, 32 * dx, 1, 1); //no shot if all 1024 are still flying
         key_delay = 1;
         player_anim[0] = 1;
     }
@@ -1109,6 +2366,77 @@ void controls() //handles keyboard, mouse controls and player movement; windows-
 // 										Physics, game logic
 //*********************************************************************************************************************
 
+//segment fraction t in [0,1] at which a point moving from (x0, y0) by (dx, dy) first comes closer than r to (cx, cy),
+//or -1 if it never does
+double first_contact(double x0, double y0, double dx, double dy, double cx, double cy, double r) {
+    double fx = x0 - cx, fy = y0 - cy;
+    double a = dx * dx + dy * dy, b = 2 * (fx * dx + fy * dy), c = fx * fx + fy * fy - r * r;
+    if (c <= 0) return 0; //already touching
+    if (a == 0) return -1;
+    double disc = b * b - 4 * a * c;
+    if (disc < 0) return -1;
+    double t = (-b - sqrt(disc)) / (2 * a);
+    return ((t >= 0) && (t <= 1)) ? t : -1;
+}
+
+//follows projectile i from (x0, y0) to where it is now, square by square like checkline(), and reports the first thing
+//it touches: an enabled enemy within projectile_reach of its path or a blocked square (the map edge counts too).
+//Enemies are looked up in enemy_grid around the piece of path in every square crossed, up to the first contact, so a
+//shot's cost does not grow with the number of projectiles or of enemies elsewhere, and fast shots can neither skip
+//enemies nor tunnel through walls
+bool sweep_projectile(int i, double x0, double y0, hit_event& hit) {
+    double x1 = projectiles.x[i], y1 = projectiles.y[i];
+    double dx = x1 - x0, dy = y1 - y0;
+    int mcx = (int)floor(x0), mcy = (int)floor(y0); //current square
+    int n = abs((int)floor(x1) - mcx) + abs((int)floor(y1) - mcy); //squares left to cross
+    int sx = (dx > 0) ? 1 : -1, sy = (dy > 0) ? 1 : -1;
+    double tdx = (dx != 0) ? fabs(1.0 / dx) : 1e30; //segment fraction needed to cross one whole square
+    double tdy = (dy != 0) ? fabs(1.0 / dy) : 1e30;
+    double tx = (dx != 0) ? ((dx > 0) ? (mcx + 1 - x0) : (x0 - mcx)) * tdx : 1e30; //segment fraction to the next vertical grid line
+    double ty = (dy != 0) ? ((dy > 0) ? (mcy + 1 - y0) : (y0 - mcy)) * tdy : 1e30; //...and the next horizontal one
+    double entered = 0; //segment fraction at which the current square was entered
+    double first = 2; //earliest enemy contact found so far
+    double len = sqrt(dx * dx + dy * dy);
+
+    hit.projectile = i;
+    hit.enemy = -1;
+    for (int k = 0;; k++) {
+        if ((mcx < 0) || (mcy < 0) || (mcx >= map_size) || (mcy >= map_size) || square_blocked(mcx, mcy)) {
+            if (first > entered) { //the wall comes before any enemy
+                hit.enemy = -1;
+                first = entered;
+            }
+            break;
+        }
+        double left = (k == n) ? 1 : std::min(tx, ty); //segment fraction at which the path leaves this square
+        double mid = 0.5 * (entered + left); //enemies touching the path inside this square are this close to its middle
+        enemy_grid.query(x0 + mid * dx, y0 + mid * dy, 0.5 * (left - entered) * len + projectile_reach, [&](const spatial::item& it) {
+            if (enemies.enabled[it.id] != 1) return; //killed earlier this tick
+            double t = first_contact(x0, y0, dx, dy, it.x, it.y, projectile_reach);
+            if ((t >= 0) && ((t < first) || ((t == first) && (it.id < hit.enemy)))) {
+                hit.enemy = it.id;
+                first = t;
+            }
+        });
+        if (k == n) break;
+        if (tx < ty) {
+            entered = tx;
+            tx += tdx;
+            mcx += sx;
+        }
+        else {
+            entered = ty;
+            ty += tdy;
+            mcy += sy;
+        }
+        if (first <= entered) break; //contacts in later squares can only come later
+    }
+    if (first > 1) return false;
+    hit.x = (float)(x0 + first * dx);
+    hit.y = (float)(y0 + first * dy);
+    return true;
+}
+
 void physics() {
     if (player.x > (map_size - 2)) player.x = map_size - 2;
     if (player.x < 2) player.x = 2; //failsafes from going out of map
@@ -1116,33 +2444,15 @@ void physics() {
     if (player.y < 2) player.y = 2;
 
     if (g_time % 8 == 0)
-        for (int i = 0; i < 64; i++) //map animations
-        {
-            if ((mapanims[i][0] == 1) && (mapanims[i][1] > 0)) mapanims[i][1]--; //door opening
-            if ((mapanims[i][0] == -1) && (mapanims[i][1] < 32)) mapanims[i][1]++;
-        }
+        animate_doors(); //map animations
 
     if (player.vx > 0.1) player.vx = 0.1;
     if (player.vx < -0.1) player.vx = -0.1; //failsafes from exceeding certain speed limit
     if (player.vy > 0.1) player.vy = 0.1;
     if (player.vy < -0.1) player.vy = -0.1;
 
-    int block, collision;
-    long int doornum;
-
-    block = map[(int)(player.x + 1 * player.vx)][(int)player.y];
-    doornum = block >> 24;
-    collision = (block % 256 > 0);
-    if ((block % 256 == 200) && (mapanims[doornum][0] == -1) && (mapanims[doornum][1] > 30)) collision = 0;
-    if ((block % 256 == 201) && (mapanims[doornum][0] == -1) && (mapanims[doornum][1] > 30)) collision = 0;
-    if (collision == 1) player.vx = -player.vx / 2; //collisions in x axis - bounce back with half the velocity
-
-    block = map[(int)player.x][(int)(player.y + 1 * player.vy)];
-    doornum = block >> 24;
-    collision = (block % 256 > 0);
-    if ((block % 256 == 200) && (mapanims[doornum][0] == -1) && (mapanims[doornum][1] > 30)) collision = 0;
-    if ((block % 256 == 201) && (mapanims[doornum][0] == -1) && (mapanims[doornum][1] > 30)) collision = 0;
-    if (collision == 1) player.vy = -player.vy / 2; //collisions in y axis
+    if (player_blocked((int)(player.x + 1 * player.vx), (int)player.y)) player.vx = -player.vx / 2; //collisions in x axis - bounce back with half the velocity
+    if (player_blocked((int)player.x, (int)(player.y + 1 * player.vy))) player.vy = -player.vy / 2; //collisions in y axis
     player.x += player.vx; //update x,y values with x,y velocities
     player.y += player.vy;
     player.z += player.vz;
@@ -1151,12 +2461,24 @@ void physics() {
     player.vz *= (1 - player.friction);
 
     // Update projectiles
-    for (int i = 0; i < 64; i++)if (projectiles[i][4] > 0)
+    static float old_x[max_projectiles], old_y[max_projectiles];
+    memcpy(old_x, projectiles.x, sizeof(old_x));
+    memcpy(old_y, projectiles.y, sizeof(old_y));
+    kernels::move(projectiles.x, projectiles.y, projectiles.vx, projectiles.vy, max_projectiles);
+    projectile_hits.clear();
+    for (int i = 0; i < max_projectiles; i++)if (projectiles.type[i] > 0)
     {
-        projectiles[i][0] += projectiles[i][2];
-        projectiles[i][1] += projectiles[i][3];
-
-        if (map[(int)(projectiles[i][0])][(int)(projectiles[i][1])] % 256 > 0) { projectiles[i][4] = 0; }
+        hit_event hit;
+        if (!sweep_projectile(i, old_x[i], old_y[i], hit)) continue; //flew on freely
+        projectile_hits.push_back(hit);
+        if (hit.enemy >= 0) {
+            enemies.hp[hit.enemy] -= projectiles.dmg[i];
+            if (enemies.hp[hit.enemy] <= 0) { //ghost destroyed
+                remove_enemy(hit.enemy);
+                player.score += 200;
+            }
+        }
+        remove_projectile(i);
     }
 
     player.vz -= player.grav; //gravity
@@ -1182,90 +2504,324 @@ void physics() {
 
 //*********************************************************************************************************************
 
-void move_enemies() {
-    double nx, ny; //new positions
-    double dst; //distance to player
-    int rating, maxrating, chosen; //current and max tile rating, chosen direction for pathfinding
+//for every square, the first of the 8 directions whose neighbouring floor square has the highest dist value;
+//enemies then steer with a single lookup instead of probing all directions themselves
+void build_flow(path_field& f) {
+    const int step[8][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 } }; //same order as flow_dirs
 
-    //this way of doing pathfinding is very costly for large maps
-    //but it's okay for pac-man
-    for (int x = 1; x < map_size - 1; x++)
-        for (int y = 1; y < map_size - 1; y++)
-            path_map[x][y] = 0; //clear path map
+    for (int x = 0; x < map_size; x++)
+        for (int y = 0; y < map_size; y++) {
+            int maxrating = 0, chosen = 0;
+            for (int dir = 0; dir < 8; dir++) {
+                int nx = (x + step[dir][0] + map_size) % map_size, ny = (y + step[dir][1] + map_size) % map_size;
+                if (!square_blocked(nx, ny) && (f.dist[nx][ny] > maxrating)) { //map tile is walkable and has higher rating? record it
+                    maxrating = f.dist[nx][ny];
+                    chosen = dir;
+                }
+            }
+            f.flow[x][y] = chosen;
+        }
+}
 
-    path_map[(int)player.x][(int)player.y] = map_size; //we set the tile occupied by the player to highest value
+//breadth-first flood from the target square (px, py)
+void build_field(path_field& f, int px, int py) {
+    static int queue[map_size * map_size]; //squares to expand, x + y * map_size
+
+    memset(f.dist, 0, sizeof(f.dist));
+    f.target[0] = px;
+    f.target[1] = py;
+    f.version = map_version;
+    path_field_builds++;
+
+    int head = 0, tail = 0;
+    f.dist[px][py] = map_size; //we set the target tile to highest value
+    queue[tail++] = px + py * map_size;
+    while (head < tail) {
+        int x = queue[head] % map_size, y = queue[head] / map_size;
+        int i = f.dist[x][y];
+        head++;
+        if ((i <= 1) || (x < 1) || (y < 1) || (x > map_size - 2) || (y > map_size - 2)) continue; //out of range / edge squares do not spread
+
+        //set empty neighbouring tiles to (i-1)
+        if ((f.dist[x + 1][y] == 0) && !square_blocked(x + 1, y)) { f.dist[x + 1][y] = i - 1; queue[tail++] = x + 1 + y * map_size; }
+        if ((f.dist[x - 1][y] == 0) && !square_blocked(x - 1, y)) { f.dist[x - 1][y] = i - 1; queue[tail++] = x - 1 + y * map_size; }
+        if ((f.dist[x][y + 1] == 0) && !square_blocked(x, y + 1)) { f.dist[x][y + 1] = i - 1; queue[tail++] = x + (y + 1) * map_size; }
+        if ((f.dist[x][y - 1] == 0) && !square_blocked(x, y - 1)) { f.dist[x][y - 1] = i - 1; queue[tail++] = x + (y - 1) * map_size; }
+    }
+    build_flow(f);
+}
 
-    for (int i = map_size; i > 0; i--)
-        for (int x = 1; x < map_size - 1; x++)
-            for (int y = 1; y < map_size - 1; y++)
-                if (path_map[x][y] == i) //the tile has value i?
-                {
-                    if ((path_map[x + 1][y] == 0) && (map[x + 1][y] % 256 == 0)) path_map[x + 1][y] = i - 1; //set empty neighbouring tiles to (i-1)
-                    if ((path_map[x - 1][y] == 0) && (map[x - 1][y] % 256 == 0)) path_map[x - 1][y] = i - 1;
-                    if ((path_map[x][y + 1] == 0) && (map[x][y + 1] % 256 == 0)) path_map[x][y + 1] = i - 1;
-                    if ((path_map[x][y - 1] == 0) && (map[x][y - 1] % 256 == 0)) path_map[x][y - 1] = i - 1;
+//walkable square closest to (x, y), which may lie in a wall or off the map; targets ahead of the player often do
+int snap_to_floor(int x, int y) {
+    if (nearest_floor_version != map_version) { //flood outwards from every walkable square at once
+        static int queue[map_size * map_size];
+        int head = 0, tail = 0;
+        for (int cx = 0; cx < map_size; cx++)
+            for (int cy = 0; cy < map_size; cy++) {
+                nearest_floor[cx][cy] = -1;
+                if (!square_blocked(cx, cy) && (cx > 0) && (cy > 0) && (cx < map_size - 1) && (cy < map_size - 1)) {
+                    nearest_floor[cx][cy] = cx + cy * map_size;
+                    queue[tail++] = cx + cy * map_size;
                 }
-    //after this step, enemies just need to go towards highest nearby number to get to the player
+            }
+        while (head < tail) {
+            int cx = queue[head] % map_size, cy = queue[head] / map_size;
+            const int nb[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+            for (const auto& d : nb) {
+                int nx = cx + d[0], ny = cy + d[1];
+                if ((nx < 0) || (ny < 0) || (nx >= map_size) || (ny >= map_size) || (nearest_floor[nx][ny] >= 0)) continue;
+                nearest_floor[nx][ny] = nearest_floor[cx][cy];
+                queue[tail++] = nx + ny * map_size;
+            }
+            head++;
+        }
+        nearest_floor_version = map_version;
+    }
+    x = std::min(map_size - 1, std::max(0, x));
+    y = std::min(map_size - 1, std::max(0, y));
+    return nearest_floor[x][y];
+}
 
-    for (int i = 0; i < 16; i++)
-        if (enemies[i].enabled == 1) {
-            nx = enemies[i].x + 8 * enemies[i].vx;
-            ny = enemies[i].y + 8 * enemies[i].vy;
-            if (map[(int)nx][(int)enemies[i].y] % 256 > 0) enemies[i].vx = -enemies[i].vx; //map collisions
-            if (map[(int)enemies[i].x][(int)ny] % 256 > 0) enemies[i].vy = -enemies[i].vy;
+//distance field leading to the walkable square nearest (x, y); built only if the cache does not have it yet
+const path_field& get_path_field(int x, int y) {
+    int t = snap_to_floor(x, y);
+    if (t < 0) t = x + y * map_size; //no floor at all
+    int tx = t % map_size, ty = t / map_size;
+
+    path_field* victim = &path_fields[0];
+    for (path_field& f : path_fields) {
+        if ((f.target[0] == tx) && (f.target[1] == ty) && (f.version == map_version)) {
+            f.used = ++path_field_clock;
+            return f;
+        }
+        if (f.used < victim->used) victim = &f; //least recently used
+    }
+    build_field(*victim, tx, ty);
+    victim->used = ++path_field_clock;
+    return *victim;
+}
 
-            enemies[i].x += enemies[i].vx; //movement
-            enemies[i].y += enemies[i].vy;
+//next square on the way from cell to goal (x + y * map_size), or -1 if there is no path;
+//the abstract route is only searched again when the map changed or the goal left its cluster
+int route_step(route_t& r, int cell, int goal) {
+    if ((r.version != pathfinder.version) || (r.goal < 0) || (pathfinder.cluster_of(r.goal) != pathfinder.cluster_of(goal))) {
+        r.version = pathfinder.version;
+        r.goal = goal;
+        r.next = 0;
+        r.step = 0;
+        r.steps.clear();
+        if (!pathfinder.find_path(cell, goal, r.waypoints)) {
+            r.waypoints.clear();
+            return -1;
+        }
+    }
+    else if (r.goal != goal) { //goal moved inside its cluster: only the last leg changes
+        r.goal = goal;
+        if (!r.waypoints.empty()) r.waypoints.back() = goal;
+        if (r.next >= (int)r.waypoints.size()) { //already on the last leg
+            r.next = (int)r.waypoints.size() - 1;
+            r.steps.clear();
+        }
+    }
+    if (r.waypoints.empty()) return -1;
+
+    if ((r.step < (int)r.steps.size()) && (cell == r.steps[r.step])) r.step++; //reached the next step
+    bool on_track = (r.step < (int)r.steps.size()) && ((r.step == 0) || (cell == r.steps[r.step - 1]));
+    if (!on_track) { //leg finished, or pushed off it: plan the way to the next waypoint from here
+        if ((r.next < (int)r.waypoints.size()) && (cell == r.waypoints[r.next])) r.next++;
+        if (r.next >= (int)r.waypoints.size()) return -1; //arrived
+        r.step = 0;
+        if (!pathfinder.refine(cell, r.waypoints[r.next], r.steps) || r.steps.empty()) {
+            r.version = -1; //left the route's clusters; search again next tick
+            return -1;
+        }
+    }
+    return r.steps[r.step];
+}
 
-            enemies[i].vx *= 0.94; //friction
-            enemies[i].vy *= 0.94;
+//k-th random number of enemy slot i for this tick (0 = movement, 1 = screen shake); the same whichever thread asks
+int enemy_roll(int i, int k) {
+    return rng::bits(settings::seed, rng::stream(rng::enemies, i), 2ull * g_time + k);
+}
 
-            maxrating = 0;
-            chosen = 0;
-            for (int dir = 0; dir < 8; dir++) //test 8 cardinal directions
-            {
-                nx = enemies[i].x + 1.4 * cos(dir * M_PI / 4);
-                ny = enemies[i].y + 1.4 * sin(dir * M_PI / 4);
-                rating = path_map[((int)nx) % map_size][((int)ny) % map_size];
-                //AI quirks of various ghosts
-                if (rand() % 8 == 0) rating += rand() % 3; //sometimes add some randomness
-
-                //map tile is floor and has higher rating? record it
-                if ((map[((int)nx) % map_size][((int)ny) % map_size] % 256 == 0) && (rating > maxrating)) {
-                    maxrating = path_map[((int)nx) % map_size][((int)ny) % map_size];
-                    chosen = dir;
-                }
-            }
-            //set the best direction
-            nx = cos(chosen * M_PI / 4);
-            ny = sin(chosen * M_PI / 4);
-            enemies[i].vx += 0.001 * nx;
-            enemies[i].vy += 0.001 * ny;
-
-            if (rand() % 16 == 0) {
-                enemies[i].vx += 0.01 * (rand() % 3 - 1); //random movements
-                enemies[i].vy += 0.01 * (rand() % 3 - 1);
-            }
+//changes enemy i's velocity for the next dt ticks, heading along field f; its random numbers come from enemy_roll(), so
+//the result does not depend on which thread runs it. Only enemy i is written; others are seen through the enemy_grid
+//snapshot. Moving, wall bounce and friction follow every tick for whole chunks in kernels::move_bounce()
+void steer_enemy(int i, const path_field& f, int dt) {
+    double x = enemies.x[i], y = enemies.y[i]; //position
+    double ax = 0, ay = 0; //velocity change
+    double dst; //distance to player
+    int chosen; //chosen direction for pathfinding
+
+    //keep apart from up to 8 other enemies, as they stood at the start of this tick
+    double sx = 0, sy = 0; //separation push
+    int near = 0;
+    enemy_grid.query(x, y, enemy_spacing, [&](const spatial::item& o) {
+        if (o.id == i) return true;
+        double dx = x - o.x, dy = y - o.y, d = sqrt(dx * dx + dy * dy);
+        if (d > 0) {
+            sx += (1 - d / enemy_spacing) * dx / d;
+            sy += (1 - d / enemy_spacing) * dy / d;
+        }
+        else sx += (o.id < i) ? 0.5 : -0.5; //exactly on top of each other: split by index
+        return ++near < 8;
+    });
+    double push = sqrt(sx * sx + sy * sy);
+    if (push > 1) { //a crowd pushes no harder than one enemy, so nobody gets squeezed through walls
+        sx /= push;
+        sy /= push;
+    }
+    ax += 0.002 * sx;
+    ay += 0.002 * sy;
+
+    //head for the best neighbouring square; out of the flood's reach, follow a pathfinder route
+    int ex = (int)x % map_size, ey = (int)y % map_size;
+    int target = (f.dist[ex][ey] == 0) ? route_step(enemy_routes[i], ex + ey * map_size, f.target[0] + f.target[1] * map_size) : -1;
+    if (target >= 0) {
+        double tx = target % map_size + 0.5 - x, ty = target / map_size + 0.5 - y;
+        double len = sqrt(tx * tx + ty * ty);
+        if (len > 0) {
+            ax += 0.001 * tx / len;
+            ay += 0.001 * ty / len;
+        }
+    }
+    else {
+        chosen = f.flow[ex][ey];
+        ax += 0.001 * flow_dirs[chosen][0];
+        ay += 0.001 * flow_dirs[chosen][1];
+    }
 
-            //player damage
-            nx = player.x;
-            ny = player.y;
-            dst = (enemies[i].x - nx) * (enemies[i].x - nx) + (enemies[i].y - ny) * (enemies[i].y - ny);
-            if (dst < 2) //less than 2 squares from player? accelerate directly towards him
-            {
-                enemies[i].vx += 0.001 * (nx - enemies[i].x);
-                enemies[i].vy += 0.001 * (ny - enemies[i].y);
-            }
+    int roll = enemy_roll(i, 0);
+    if (roll % 16 == 0) {
+        ax += 0.01 * ((roll / 16) % 3 - 1); //random movements
+        ay += 0.01 * ((roll / 48) % 3 - 1);
+    }
 
-            if ((dst < 0.5) && (player.hp > 0) && (player.status[1] == 0)) { //enemy close? positive hp? no god mode?
-                player.hp -= 0.25;
-                player.z += 0.05 * (rand() % 3 - 1); //vertical screen shake
-                player.ang_h += 2 * (rand() % 3 - 1); //horizontal screen shake
-                player.z *= 0.99; //make sure vertical shake is not too big
-                player.status[0] = 32; //player hurt status
-            }
+    //player damage
+    dst = (x - player.x) * (x - player.x) + (y - player.y) * (y - player.y);
+    if ((dst < 2) && checkline(x, y, player.x, player.y)) //less than 2 squares from player and can see him? accelerate directly towards him
+    {
+        ax += 0.001 * (player.x - x);
+        ay += 0.001 * (player.y - y);
+    }
+
+    enemies.vx[i] += (float)(ax * dt);
+    enemies.vy[i] += (float)(ay * dt);
+}
+
+//ghost personalities, as in Pac-Man: ghosts take turns scattering to their corners and chasing the player
+const int scatter_ticks = 420, chase_ticks = 1200; //length of the two phases
+const int ghost_corners[4][2] = { { map_size - 2, 1 }, { 1, 1 }, { map_size - 2, map_size - 2 }, { 1, map_size - 2 } }; //scatter corner per ghost type
+
+//chase targets of the 4 ghost types this tick: Blinky goes for the player, Pinky 4 squares ahead of him, Inky for the
+//point mirroring Blinky about 2 squares ahead of the player, Clyde for the player (but see move_enemies())
+void ghost_targets(int targets[4][2]) {
+    double dx = cos(player.ang_h / 10.0 * torad), dy = sin(player.ang_h / 10.0 * torad); //player heading
+    int px = (int)player.x, py = (int)player.y;
+    double bx = player.x, by = player.y; //first Blinky
+    for (int i = 0; i < enemies.count; i++)
+        if ((enemies.enabled[i] == 1) && (enemies.type[i] % 4 == 0)) {
+            bx = enemies.x[i];
+            by = enemies.y[i];
+            break;
+        }
+
+    targets[0][0] = px;
+    targets[0][1] = py;
+    targets[1][0] = (int)floor(player.x + 4 * dx);
+    targets[1][1] = (int)floor(player.y + 4 * dy);
+    targets[2][0] = (int)floor(2 * (player.x + 2 * dx) - bx);
+    targets[2][1] = (int)floor(2 * (player.y + 2 * dy) - by);
+    targets[3][0] = px;
+    targets[3][1] = py;
+}
 
-        } //end of looping through enemies
+//level of detail bucket for an enemy d squares from the player, in sight or not
+int lod_bucket(double d, bool in_sight) {
+    if (d < lod_range[0]) return 0;
+    if (d < lod_range[1]) return in_sight ? 0 : 1;
+    return in_sight ? 1 : 2;
+}
+
+void move_enemies() {
+    static std::vector<int> touching; //enemies touching the player
+    static unsigned char blocked[map_size * map_size]; //square_blocked() for kernels::move_bounce(), [x * map_size + y]
+    static int blocked_version = -1;
+    static char view[map_size][map_size]; //squares with a clear line to the player, from shadowcast()
+    static int view_square = -1, view_version = -1; //player square and map_version view was cast for
+    const int chunk = 256; //enemies per job; a multiple of 4
+
+    //one field per distinct target, looked up before the parallel part so workers only read them; Clyde keeps his
+    //corner field too, he retreats there whenever he gets within 8 squares of the player
+    const path_field* chase[4];
+    const path_field* corner[4];
+    bool scatter = (g_time % (scatter_ticks + chase_ticks)) < scatter_ticks;
+    int targets[4][2];
+    ghost_targets(targets);
+    for (int t = 0; t < 4; t++) {
+        corner[t] = ((t == 3) || scatter) ? &get_path_field(ghost_corners[t][0], ghost_corners[t][1]) : NULL;
+        chase[t] = scatter ? corner[t] : &get_path_field(targets[t][0], targets[t][1]);
+    }
+    //after this step, enemies just need to go towards highest nearby number to get to their target
+    if (blocked_version != map_version) {
+        for (int x = 0; x < map_size; x++)
+            for (int y = 0; y < map_size; y++) blocked[x * map_size + y] = square_blocked(x, y) ? 1 : 0;
+        blocked_version = map_version;
+    }
+    int pcx = (int)player.x, pcy = (int)player.y;
+    if ((view_square != pcx + pcy * map_size) || (view_version != map_version)) {
+        memset(view, 0, sizeof(view));
+        if ((pcx >= 0) && (pcy >= 0) && (pcx < map_size) && (pcy < map_size)) {
+            view[pcx][pcy] = 2;
+            for (int q = 0; q < 4; q++) shadowcast(q, pcx, pcy, 1, -1, 1, map_size, view);
+        }
+        view_square = pcx + pcy * map_size;
+        view_version = map_version;
+    }
+
+    double hx = cos(player.ang_h / 10.0 * torad), hy = sin(player.ang_h / 10.0 * torad); //player heading
+    double view_cos = cos(0.1 * fov * torad); //in view: in a visible square, within the angle draw_enemies() draws at
+
+    int count = enemies.count, padded = (int)enemies.x.size(), chunks = (padded + chunk - 1) / chunk;
+
+    //steering is the expensive part, so farther buckets steer every lod_period-th tick (staggered by slot) for that
+    //many ticks at once; moving stays at full rate, so walls and the sprites on screen see no difference.
+    //Moving to a nearer bucket is immediate, moving away needs lod_margin more distance or lod_sight_ticks out of sight
+    jobs::parallel_for(chunks, settings::threads, [&](int c) {
+        int first = c * chunk, last = std::min(padded, (c + 1) * chunk);
+        for (int i = first; i < std::min(count, last); i++)
+            if (enemies.enabled[i] == 1) {
+                int t = enemies.type[i] % 4;
+                double dx = enemies.x[i] - player.x, dy = enemies.y[i] - player.y, d = sqrt(dx * dx + dy * dy);
+                int b = 0;
+                if (settings::lod) {
+                    int ex = std::min(map_size - 1, std::max(0, (int)enemies.x[i])), ey = std::min(map_size - 1, std::max(0, (int)enemies.y[i]));
+                    if ((view[ex][ey] > 0) && ((d < 1) || (dx * hx + dy * hy) > view_cos * d)) enemies.seen[i] = g_time;
+                    bool in_sight = g_time - enemies.seen[i] < lod_sight_ticks;
+                    b = lod_bucket(d, in_sight);
+                    if (b > enemies.lod[i]) b = std::max((int)enemies.lod[i], lod_bucket(d - lod_margin, in_sight));
+                }
+                enemies.lod[i] = (unsigned char)b;
+                if ((g_time + i) % lod_period[b] == 0) steer_enemy(i, ((t == 3) && (d < 8)) ? *corner[t] : *chase[t], lod_period[b]);
+            }
+        kernels::move_bounce(&enemies.x[first], &enemies.y[first], &enemies.vx[first], &enemies.vy[first], last - first, blocked, map_size, 8, enemy_friction);
+    });
+    update_enemy_grid();
+    memset(lod_counts, 0, sizeof(lod_counts));
+    for (int i = 0; i < count; i++) lod_counts[enemies.lod[i]] += (enemies.enabled[i] == 1);
+
+    touching.clear();
+    enemy_grid.query(player.x, player.y, sqrt(0.5), [&](const spatial::item& it) { touching.push_back(it.id); }); //enemies close enough to hurt
+    std::sort(touching.begin(), touching.end()); //enemy order, exactly like a serial loop
+    for (int i : touching)
+        if ((player.hp > 0) && (player.status[1] == 0)) { //positive hp? no god mode?
+            player.hp -= 0.25;
+            int roll = enemy_roll(i, 1);
+            player.z += 0.05 * (roll % 3 - 1); //vertical screen shake
+            player.ang_h += 2 * ((roll / 3) % 3 - 1); //horizontal screen shake
+            player.z *= 0.99; //make sure vertical shake is not too big
+            player.status[0] = 32; //player hurt status
+        }
 }
 
 //*********************************************************************************************************************
@@ -1278,35 +2834,31 @@ void minimap(int type) {
         for (int x = 0; x < map_size - 1; x++)
             for (int y = 0; y < map_size - 1; y++) {
                 char_buff[x + y * res_X] = '#';
-                color_buff[x + y * res_X] = 8 * (map[x][y] % 256 > 0);
+                color_buff[x + y * res_X] = 8 * (map[x][y].wall > 0);
             }
 
         color_buff[(int)player.x + (int)player.y * res_X] = 15; //highlight player
         char_buff[(int)player.x + (int)player.y * res_X] = '@';
 
-        color_buff[(int)enemies[0].x + (int)enemies[0].y * res_X] = 12; //highlight enemies
-        char_buff[(int)enemies[0].x + (int)enemies[0].y * res_X] = '*';
-        color_buff[(int)enemies[1].x + (int)enemies[1].y * res_X] = 13;
-        char_buff[(int)enemies[1].x + (int)enemies[1].y * res_X] = '*';
-        color_buff[(int)enemies[2].x + (int)enemies[2].y * res_X] = 10;
-        char_buff[(int)enemies[2].x + (int)enemies[2].y * res_X] = '*';
-        color_buff[(int)enemies[3].x + (int)enemies[3].y * res_X] = 14;
-        char_buff[(int)enemies[3].x + (int)enemies[3].y * res_X] = '*';
+        for (int i = 0; i < enemies.count; i++) //highlight enemies
+            if (enemies.enabled[i] == 1) {
+                color_buff[(int)enemies.x[i] + (int)enemies.y[i] * res_X] = ghost_colors[enemies.type[i] % 4];
+                char_buff[(int)enemies.x[i] + (int)enemies.y[i] * res_X] = '*';
+            }
     }
 
     if (type == 1) //shows pathfinding map-for debug purposes
     {
+        const path_field& f = get_path_field((int)player.x, (int)player.y); //one lookup, not one per square
         for (int x = 1; x < map_size - 1; x++)
             for (int y = 1; y < map_size - 1; y++) {
-                char_buff[x + y * res_X] = 'a' + path_map[x][y];
+                char_buff[x + y * res_X] = 'a' + f.dist[x][y];
                 color_buff[x + y * res_X] = 7;
-                if (map[x][y] % 256 > 0) color_buff[x + y * res_X] = 0; //wall
+                if (map[x][y].wall > 0) color_buff[x + y * res_X] = 0; //wall
             }
         color_buff[(int)player.x + (int)player.y * res_X] = 10; //highlight player
-        color_buff[(int)enemies[0].x + (int)enemies[0].y * res_X] = 12; //highlight enemies
-        color_buff[(int)enemies[1].x + (int)enemies[1].y * res_X] = 13;
-        color_buff[(int)enemies[2].x + (int)enemies[2].y * res_X] = 10;
-        color_buff[(int)enemies[3].x + (int)enemies[3].y * res_X] = 14;
+        for (int i = 0; i < enemies.count; i++) //highlight enemies
+            if (enemies.enabled[i] == 1) color_buff[(int)enemies.x[i] + (int)enemies.y[i] * res_X] = ghost_colors[enemies.type[i] % 4];
     }
 
 }
@@ -1315,13 +2867,196 @@ void minimap(int type) {
 // 									 Main game loop
 //*********************************************************************************************************************
 
-int main() {
+//times the hierarchical pathfinder on a synthetic 1024x1024 map with a quarter of the squares blocked,
+//and checks its path lengths against a breadth-first search of the whole grid
+void benchmark_paths() {
+    const int size = 1024, queries = 1000, checked = 100;
+    auto blocked = [](int x, int y) { return (x == 0) || (y == 0) || (x == size - 1) || (y == size - 1) || (((unsigned)x * 73856093u ^ (unsigned)y * 19349663u) * 2654435761u >> 24) % 4 == 0; };
+    auto cell_hash = [](int i) { return (int)((unsigned)(i + 1) * 2654435761u % (size * size)); };
+    hpa::graph g;
+
+    std::cout << "Pathfinding benchmark: " << size << "x" << size << " map, clusters of 16\n";
+    auto start = std::chrono::steady_clock::now();
+    g.build(size, size, 16, [&](int x, int y) { return !blocked(x, y); });
+    std::cout << "  build: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms, " << g.nodes.size() << " abstract nodes\n";
+
+    std::vector<int> from, to, waypoints, steps, dist(size * size), queue(size * size);
+    for (int i = 0; from.size() < queries; i += 2) { //random walkable pairs
+        int a = cell_hash(i), b = cell_hash(i + 1);
+        if (g.walk[a] && g.walk[b]) {
+            from.push_back(a);
+            to.push_back(b);
+        }
+    }
+
+    int found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++) found += g.find_path(from[q], to[q], waypoints);
+    std::cout << "  find_path: " << 1000 * std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / queries << " us per query, " << found << "/" << queries << " found\n";
+
+    long long hpa_len = 0, best_len = 0;
+    for (int q = 0; q < checked; q++) {
+        if (!g.find_path(from[q], to[q], waypoints)) continue;
+        int cur = from[q];
+        for (int w : waypoints) {
+            g.refine(cur, w, steps);
+            hpa_len += steps.size();
+            cur = w;
+        }
+        std::fill(dist.begin(), dist.end(), -1); //reference: plain BFS over the whole map
+        int head = 0, tail = 0;
+        dist[from[q]] = 0;
+        queue[tail++] = from[q];
+        while ((head < tail) && (dist[to[q]] < 0)) {
+            int c = queue[head++];
+            const int nb[4] = { 1, -1, size, -size };
+            for (int d : nb)
+                if (g.walk[c + d] && (dist[c + d] < 0)) {
+                    dist[c + d] = dist[c] + 1;
+                    queue[tail++] = c + d;
+                }
+        }
+        best_len += dist[to[q]];
+    }
+    std::cout << "  path length vs shortest: " << (best_len ? (double)hpa_len / best_len : 0) << "x over " << checked << " queries\n";
+
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++) { //close and reopen a square, like a door
+        g.set_walkable(from[q] % size, from[q] / size, false);
+        g.set_walkable(from[q] % size, from[q] / size, true);
+    }
+    std::cout << "  set_walkable: " << 1000 * std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / (2 * queries) << " us per change\n";
+}
+
+//*********************************************************************************************************************
+// 									 Headless benchmark
+//*********************************************************************************************************************
+
+//input for headless runs without a recording: mostly walking forward, now and then backing off or strafing, turning
+//back and forth, shooting and using doors; a new plan every 60 ticks, picked with the seed
+replay::frame scripted_input(int tick) {
+    replay::frame in;
+    int plan = rng::below(8, settings::seed, rng::stream(rng::input, 0), tick / 60);
+    in.keys = (plan < 6) ? replay::key_w : replay::key_s;
+    if (plan == 1) in.keys |= replay::key_a;
+    if (plan == 2) in.keys |= replay::key_d;
+    if (tick % 120 == 60) in.keys |= replay::key_e;
+    in.buttons = (tick % 30 == 0) ? 1 : 0;
+    in.mouse_x = (short)(P_Res_X / 2 + 700 * sin(0.003 * tick) + 100 * sin(0.05 * tick)); //within half a turn either way
+    in.mouse_y = (short)(P_Res_Y / 2);
+    return in;
+}
+
+//runs only the simulation - input, controls, physics (doors, projectiles) and enemies - for ticks ticks, or until the
+//replay ends when ticks is 0, and prints how long each part took; nothing is drawn, so the numbers do not depend on
+//the raycaster or SDL
+void run_headless(int ticks) {
+    const int parts = 3;
+    const char* names[parts] = { "input + controls", "physics", "enemies" };
+    double spent[parts] = {}; //seconds
+    if ((ticks <= 0) && !replaying) ticks = 1000;
+    std::cout << "Headless: " << (ticks > 0 ? std::to_string(ticks) : std::string("all")) << " ticks, " << enemies.count << " enemies, "
+        << (replaying ? "replayed" : "scripted") << " input, " << jobs::hardware_threads() << " hardware threads\n";
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; ((ticks <= 0) || (t < ticks)) && (F_exit == 0); t++) {
+        auto t0 = std::chrono::steady_clock::now();
+        replay::frame in;
+        if (replaying) {
+            if (!input_replay.next(in)) break;
+        }
+        else {
+            in = scripted_input(g_time);
+            if (input_recorder.is_open()) input_recorder.add(in);
+        }
+        controls(in);
+        auto t1 = std::chrono::steady_clock::now();
+        physics();
+        auto t2 = std::chrono::steady_clock::now();
+        move_enemies();
+        auto t3 = std::chrono::steady_clock::now();
+        g_time++;
+
+        spent[0] += std::chrono::duration<double>(t1 - t0).count();
+        spent[1] += std::chrono::duration<double>(t2 - t1).count();
+        spent[2] += std::chrono::duration<double>(t3 - t2).count();
+        frame_times.push_back(std::chrono::duration<float, std::milli>(t3 - t0).count());
+    }
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int done = (int)frame_times.size();
+    printf("%d ticks in %.3f s: %.0f ticks/s\n", done, total, done / total);
+    for (int p = 0; p < parts; p++) printf("  %-18s %8.4f ms/tick %5.1f%%\n", names[p], 1000 * spent[p] / std::max(1, done), 100 * spent[p] / total);
+    printf("  level of detail buckets at the end: %d/%d/%d\n", lod_counts[0], lod_counts[1], lod_counts[2]);
+    finish_recording();
+    if (!replaying && !settings::record_file) std::cout << "State hash " << std::hex << state_hash() << std::dec << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    // Command line
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-benchlights")) settings::bench_lights = true;
+        if (!strcmp(argv[i], "-benchrays")) settings::bench_rays = true;
+        if (!strcmp(argv[i], "-benchpaths")) settings::bench_paths = true;
+        if (!strcmp(argv[i], "-benchlos")) settings::bench_los = true;
+        if (!strcmp(argv[i], "-nocache")) settings::light_cache = false;
+        if (!strcmp(argv[i], "-nolod")) settings::lod = false;
+        if (!strcmp(argv[i], "-blur") && (i + 1 < argc)) settings::light_blur = std::max(0, atoi(argv[++i])); //negative radii would make empty blur windows
+        if (!strcmp(argv[i], "-ghosts") && (i + 1 < argc)) settings::arena_ghosts = atoi(argv[++i]);
+        if (!strcmp(argv[i], "-views") && (i + 1 < argc)) settings::views = atoi(argv[++i]);
+        if (!strcmp(argv[i], "-threads") && (i + 1 < argc)) settings::threads = atoi(argv[++i]);
+        if (!strcmp(argv[i], "-seed") && (i + 1 < argc)) settings::seed = strtoull(argv[++i], NULL, 10);
+        if (!strcmp(argv[i], "-record") && (i + 1 < argc)) settings::record_file = argv[++i];
+        if (!strcmp(argv[i], "-replay") && (i + 1 < argc)) settings::replay_file = argv[++i];
+        if (!strcmp(argv[i], "-times") && (i + 1 < argc)) settings::times_file = argv[++i];
+        if (!strcmp(argv[i], "-headless") && (i + 1 < argc)) settings::headless = atoi(argv[++i]);
+        if (!strcmp(argv[i], "-map") && (i + 1 < argc)) settings::map = argv[++i];
+        if (!strcmp(argv[i], "-load") && (i + 1 < argc)) settings::load_file = argv[++i];
+        if (!strcmp(argv[i], "-compilemap") && (i + 1 < argc)) settings::compile_map = argv[++i];
+    }
+    if (settings::load_file && (settings::record_file || settings::replay_file)) { //recordings start from a freshly loaded map
+        std::cerr << "-load cannot be combined with -record or -replay" << std::endl;
+        return 1;
+    }
+    if (settings::replay_file) { //the recording decides everything that changes the game
+        if (!input_replay.load(settings::replay_file)) {
+            std::cerr << "Unable to read recording: " << settings::replay_file << std::endl;
+            return 1;
+        }
+        replaying = true;
+        settings::seed = input_replay.head.seed;
+        settings::arena_ghosts = input_replay.head.ghosts;
+        settings::lod = input_replay.head.lod != 0;
+        std::cout << "Replaying " << settings::replay_file << ": " << input_replay.head.ticks << " ticks on map " << input_replay.head.map << "\n";
+    }
+    if (settings::seed == 0) settings::seed = rng::mix(std::chrono::system_clock::now().time_since_epoch().count()) | 1; //any nonzero value
+    std::cout << "Seed: " << settings::seed << " (-seed " << settings::seed << " repeats this game)\n";
+
+    if (settings::compile_map) { //convert a map and quit
+        init_math();
+        return compile_map(settings::compile_map) ? 0 : 1;
+    }
+
     // Map loading
     std::string mapPath;
-    std::cout << "Which map file do you choose (excluding extension)? Type 'D' for default: \n";
-    std::cout << "List of maps: \n";
-    listFilesWithExtension("maps", ".pac");
-    std::cin >> mapPath;
+    if (replaying) mapPath = input_replay.head.map;
+    else if (settings::map) mapPath = settings::map;
+    else if (settings::headless >= 0) mapPath = "D";
+    else {
+        std::cout << "Which map file do you choose (excluding extension)? Type 'D' for default: \n";
+        std::cout << "List of maps: \n";
+        listFilesWithExtension("maps", ".pac");
+        std::cin >> mapPath;
+    }
+
+    if (settings::headless >= 0) { //simulation only: no window, textures or lights
+        init_math();
+        gen_map_pacman(mapPath);
+        if (settings::load_file) load_snapshot_file(settings::load_file);
+        start_recording(mapPath);
+        run_headless(settings::headless);
+        return 0;
+    }
 
     // Setup
     char str[10]; //for status display
@@ -1332,11 +3067,17 @@ int main() {
     loadsprites();
     initImGui();
 
+    if (settings::bench_rays) benchmark_rays();
+    if (settings::bench_los) benchmark_los();
+    if (settings::bench_paths) benchmark_paths();
     gen_map_pacman(mapPath);
     gen_sky(10);
     calculate_lights();
+    if (settings::load_file) load_snapshot_file(settings::load_file); //after the bake: squares the save changed are relit incrementally
     debug[0] = 1;
     bool done = false;
+    start_recording(mapPath);
+    if (replaying) state = 1; //straight into the game
 
     while (F_exit == 0) //main game loop
     {
@@ -1378,13 +3119,17 @@ int main() {
         }
         if (state == 1) {
             SDL_SetRelativeMouseMode(SDL_TRUE);
-            controls();
+            auto tick_start = std::chrono::steady_clock::now();
+            replay::frame input;
+            if (!read_input(input)) { //recording played to the end
+                F_exit = 1;
+                break;
+            }
+            controls(input);
             physics();
             move_enemies();
-            cast();
-            draw();
-            draw_enemies();
-            draw_projectiles();
+            update_light_rebake();
+            render_views();
             minimap(0);
             post_processing();
             HUD();
@@ -1398,12 +3143,20 @@ int main() {
 
             //printf(str, "fps: %d hp: %d stamina: %d battery: %d score: %d", fps, (int)player.hp, (int)player.stamina, (int)(100 * player.battery), (int)player.score);
             drawstring(0, 10, str);
+            if (settings::arena_ghosts > 0) { //crowds: show what the level of detail saves
+                char lod_str[64];
+                snprintf(lod_str, sizeof(lod_str), "ghosts steering every 1/2/4 ticks: %d/%d/%d", lod_counts[0], lod_counts[1], lod_counts[2]);
+                drawstring(res_X, 10, lod_str);
+            }
             drawstring(res_X * (res_Y - 1), 10, (char*)
                 "WASD to move, space to jump, F for flashlight");
             display(debug[0]); //several types of display to choose
-            SDL_Delay(5);
+            frame_times.push_back(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - tick_start).count());
+            if (!replaying) SDL_Delay(5); //replays run flat out
         }
     }
+
+    finish_recording();
     //SDL_FreeCursor(cursor);
     cleanup();
     return 0;
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//*********************************************************************************************************************
+// 										Compiled maps
+//*********************************************************************************************************************
+//A compiled map is a header followed by sections of fixed-size records: cells, lights, spawn points and optionally a
+//baked lightmap. Every section starts on a 64-byte boundary, so once the file is mapped and view() has checked the
+//header, the sections are used where they are instead of being parsed or copied.
+namespace mapbin {
+	const int version = 1; //bump whenever the layout changes
+	const size_t align = 64; //section alignment in bytes
+
+	//one map square, laid out like cell_t in main.cpp
+	struct cell {
+		unsigned char wall, floor, ceiling, unused;
+	};
+
+	//one static light, laid out like a row of static_lights
+	struct light {
+		double x, y, strength, height;
+	};
+
+	struct spawn {
+		double x, y;
+		int kind; //-1 = player start, 0.. = ghost type
+		int unused;
+	};
+
+	struct section {
+		unsigned long long offset; //bytes from the start of the file
+		unsigned long long count; //records
+	};
+
+	struct header {
+		char magic[4]; //"PMAP"
+		int version; //mapbin::version
+		int width, height; //squares
+		section cells; //width * height cells, column by column like map[x][y]
+		section lights;
+		section spawns;
+		section lightmap; //doubles: light_raw followed by lightmap, both (16 * width) x (16 * height); empty if not baked
+		unsigned long long lightmap_key; //light_cache_key() the lightmap was baked for
+	};
+
+	//pointers into a checked file
+	struct map_view {
+		const header* head = nullptr;
+		const cell* cells = nullptr;
+		const light* lights = nullptr;
+		const spawn* spawns = nullptr;
+		double* lightmap = nullptr; //writable, so it can be rebaked in place in a copy-on-write mapping; null if not baked
+	};
+
+	//section s holds count records of T that lie inside the file
+	template <class T>
+	bool section_fits(const section& s, size_t size) {
+		return (s.offset % align == 0) && (s.offset >= sizeof(header)) && (s.offset <= size) && (s.count <= (size - s.offset) / sizeof(T));
+	}
+
+	//checks the header and every section against the file size; data must be aligned to 64 bytes (mappings are)
+	inline bool view(char* data, size_t size, map_view& v) {
+		v = map_view();
+		if (size < sizeof(header)) return false;
+		const header* h = (const header*)data;
+		if (memcmp(h->magic, "PMAP", 4) || (h->version != version) || (h->width <= 0) || (h->height <= 0) || (h->width > 4096) || (h->height > 4096)) return false;
+
+		unsigned long long texels = 16ull * h->width * 16ull * h->height;
+		if (!section_fits<cell>(h->cells, size) || (h->cells.count != (unsigned long long)h->width * h->height)) return false;
+		if (!section_fits<light>(h->lights, size) || !section_fits<spawn>(h->spawns, size)) return false;
+		if (!section_fits<double>(h->lightmap, size) || ((h->lightmap.count != 0) && (h->lightmap.count != 2 * texels))) return false;
+
+		v.head = h;
+		v.cells = (const cell*)(data + h->cells.offset);
+		v.lights = (const light*)(data + h->lights.offset);
+		v.spawns = (const spawn*)(data + h->spawns.offset);
+		if (h->lightmap.count) v.lightmap = (double*)(data + h->lightmap.offset);
+		return true;
+	}
+
+	//writes a compiled map; light_raw and lightmap hold (16 * width) x (16 * height) doubles each, or are both null if
+	//the map is not baked
+	inline bool write(const std::string& path, int width, int height, const std::vector<cell>& cells, const std::vector<light>& lights, const std::vector<spawn>& spawns, const double* light_raw, const double* lightmap, unsigned long long lightmap_key) {
+		std::vector<char> out(sizeof(header));
+		auto add = [&](section& s, const void* p, size_t count, size_t record) {
+			out.resize((out.size() + align - 1) / align * align);
+			s = { out.size(), count };
+			out.insert(out.end(), (const char*)p, (const char*)p + count * record);
+		};
+
+		header h = { { 'P', 'M', 'A', 'P' }, version, width, height, {}, {}, {}, {}, 0 }; //sections are filled in below
+		add(h.cells, cells.data(), cells.size(), sizeof(cell));
+		add(h.lights, lights.data(), lights.size(), sizeof(light));
+		add(h.spawns, spawns.data(), spawns.size(), sizeof(spawn));
+		size_t texels = (light_raw && lightmap) ? (16ull * width) * (16ull * height) : 0;
+		add(h.lightmap, light_raw, texels, sizeof(double));
+		out.insert(out.end(), (const char*)lightmap, (const char*)lightmap + texels * sizeof(double));
+		h.lightmap.count *= 2;
+		h.lightmap_key = texels ? lightmap_key : 0;
+		memcpy(out.data(), &h, sizeof(h));
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		return file.write(out.data(), out.size()) ? true : false;
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <Windows.h>
+
+//*********************************************************************************************************************
+// 										Memory-mapped files
+//*********************************************************************************************************************
+
+//a whole file mapped into memory; pages are copy-on-write, so the data can be patched in memory without touching the file
+struct mapped_file {
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+	char* data = NULL;
+	size_t size = 0;
+};
+
+inline void close_mapped(mapped_file& f) {
+	if (f.data) UnmapViewOfFile(f.data);
+	if (f.mapping) CloseHandle(f.mapping);
+	if (f.file != INVALID_HANDLE_VALUE) CloseHandle(f.file);
+	f = mapped_file();
+}
+
+//maps the file at path; returns false (and leaves f closed) if it does not exist or cannot be mapped
+inline bool open_mapped(mapped_file& f, const std::string& path) {
+	close_mapped(f);
+	f.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f.file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(f.file, &size) || (size.QuadPart == 0)) {
+		close_mapped(f);
+		return false;
+	}
+	f.size = (size_t)size.QuadPart;
+	f.mapping = CreateFileMappingA(f.file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (f.mapping) f.data = (char*)MapViewOfFile(f.mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (!f.data) {
+		close_mapped(f);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//*********************************************************************************************************************
+// 										Input recording and replay
+//*********************************************************************************************************************
+//A recording is a header (seed, map and the settings that change the game) followed by the input of every tick.
+//Input rarely changes from one tick to the next, so ticks are stored as runs: a frame and how many ticks it lasted.
+//Feeding the frames back into a game started from the same header plays the same game, tick for tick.
+namespace replay {
+	//keys the game reacts to, one bit each
+	enum key {
+		key_w = 1 << 0,
+		key_a = 1 << 1,
+		key_s = 1 << 2,
+		key_d = 1 << 3,
+		key_space = 1 << 4,
+		key_e = 1 << 5,
+		key_f = 1 << 6,
+		key_g = 1 << 7,
+		key_h = 1 << 8,
+		key_escape = 1 << 9,
+		key_f5 = 1 << 10,
+		key_f9 = 1 << 11,
+	};
+
+	//input state of one tick
+	struct frame {
+		unsigned short keys = 0; //key bits
+		short mouse_x = 0, mouse_y = 0; //window coordinates
+		unsigned char buttons = 0; //1 = left mouse button
+
+		bool operator==(const frame& o) const {
+			return (keys == o.keys) && (mouse_x == o.mouse_x) && (mouse_y == o.mouse_y) && (buttons == o.buttons);
+		}
+	};
+
+	const int version = 2; //bump whenever the format or anything the game reads from it changes
+
+	struct header {
+		char magic[4] = { 'P', 'R', 'E', 'C' };
+		int version = replay::version;
+		unsigned long long seed = 0; //settings::seed
+		int ghosts = 0; //settings::arena_ghosts
+		int lod = 1; //settings::lod
+		char map[64] = {}; //map name as typed at the prompt
+		unsigned long long ticks = 0; //ticks recorded; filled in when the recording is closed
+		unsigned long long final_hash = 0; //game state hash after the last tick; likewise
+	};
+
+	//writes a recording tick by tick; close() fills in the header and must be called for the file to be usable
+	class recorder {
+	public:
+		bool open(const std::string& path, const header& h) {
+			file.open(path, std::ios::binary | std::ios::trunc);
+			if (!file.is_open()) return false;
+			head = h;
+			run = 0;
+			file.write((const char*)&head, sizeof(head));
+			return true;
+		}
+
+		bool is_open() const {
+			return file.is_open();
+		}
+
+		void add(const frame& f) {
+			if ((run > 0) && ((f == last) && (run < 0xffff))) {
+				run++;
+				return;
+			}
+			flush();
+			last = f;
+			run = 1;
+		}
+
+		void close(unsigned long long final_hash) {
+			if (!file.is_open()) return;
+			flush();
+			head.final_hash = final_hash;
+			file.seekp(0);
+			file.write((const char*)&head, sizeof(head));
+			file.close();
+		}
+
+	private:
+		std::ofstream file;
+		header head;
+		frame last;
+		unsigned int run = 0; //ticks the last frame has lasted so far
+
+		void flush() {
+			if (run == 0) return;
+			unsigned short count = (unsigned short)run;
+			file.write((const char*)&last.keys, sizeof(last.keys));
+			file.write((const char*)&last.mouse_x, sizeof(last.mouse_x));
+			file.write((const char*)&last.mouse_y, sizeof(last.mouse_y));
+			file.write((const char*)&last.buttons, sizeof(last.buttons));
+			file.write((const char*)&count, sizeof(count));
+			head.ticks += run;
+		}
+	};
+
+	//reads a whole recording and hands out its frames in order
+	class reader {
+	public:
+		header head;
+
+		//false if the file is missing, from another version or cut short
+		bool load(const std::string& path) {
+			std::ifstream file(path, std::ios::binary);
+			if (!file.read((char*)&head, sizeof(head)) || memcmp(head.magic, "PREC", 4) || (head.version != version)) return false;
+			runs.clear();
+			unsigned long long ticks = 0;
+			for (;;) {
+				frame f;
+				unsigned short count;
+				if (!file.read((char*)&f.keys, sizeof(f.keys))) break;
+				file.read((char*)&f.mouse_x, sizeof(f.mouse_x));
+				file.read((char*)&f.mouse_y, sizeof(f.mouse_y));
+				file.read((char*)&f.buttons, sizeof(f.buttons));
+				if (!file.read((char*)&count, sizeof(count))) return false;
+				runs.push_back({ f, count });
+				ticks += count;
+			}
+			next_run = 0;
+			used = 0;
+			return ticks == head.ticks;
+		}
+
+		//next tick's input; false once every recorded tick has been played
+		bool next(frame& f) {
+			if (next_run >= runs.size()) return false;
+			f = runs[next_run].f;
+			if (++used == runs[next_run].count) {
+				next_run++;
+				used = 0;
+			}
+			return true;
+		}
+
+	private:
+		struct run_t {
+			frame f;
+			unsigned short count;
+		};
+		std::vector<run_t> runs;
+		size_t next_run = 0;
+		unsigned int used = 0; //ticks of runs[next_run] already played
+	};
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+//*********************************************************************************************************************
+// 										Counter-based random numbers
+//*********************************************************************************************************************
+//Every number is a hash of (seed, stream, counter), SplitMix64 style, instead of the next value of a shared sequence.
+//Any entity, tick or texel can get its own numbers directly, in any order and from any thread, and the same seed
+//always gives the same numbers.
+namespace rng {
+	//streams: what the numbers are for; combine with an index via stream()
+	enum domain {
+		textures = 1,
+		sky = 2,
+		spawns = 3,
+		enemies = 4,
+		input = 5,
+	};
+
+	inline unsigned long long stream(domain d, unsigned long long index) {
+		return ((unsigned long long)d << 48) ^ index;
+	}
+
+	//SplitMix64 finalizer
+	inline unsigned long long mix(unsigned long long z) {
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	//31 random bits, like rand() but with a much longer range
+	inline int bits(unsigned long long seed, unsigned long long stream, unsigned long long counter) {
+		return (int)(mix(mix(seed + 0x9e3779b97f4a7c15ull * (stream + 1)) ^ counter) >> 33);
+	}
+
+	//uniform in 0..n-1
+	inline int below(int n, unsigned long long seed, unsigned long long stream, unsigned long long counter) {
+		return (int)(((unsigned long long)bits(seed, stream, counter) * (unsigned long long)n) >> 31);
+	}
+}
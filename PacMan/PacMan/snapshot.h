@@ -0,0 +1,89 @@
+#pragma once
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+//*********************************************************************************************************************
+// 										Binary snapshots
+//*********************************************************************************************************************
+//A snapshot is one contiguous block of bytes: plain values and arrays copied in one after another, and vectors as
+//their length followed by their elements. writer and reader have the same value()/vector() calls, so one function
+//can list the fields for both directions. The reader checks every length, so a truncated or mismatched blob fails
+//cleanly instead of reading past its end.
+namespace snapshot {
+	class writer {
+	public:
+		static constexpr bool loading = false;
+
+		explicit writer(std::vector<char>& out) : out(out) {}
+
+		void bytes(const void* p, size_t n) {
+			out.insert(out.end(), (const char*)p, (const char*)p + n);
+		}
+
+		template <class T>
+		void value(const T& v) {
+			static_assert(std::is_trivially_copyable_v<T>, "snapshots copy values byte by byte");
+			bytes(&v, sizeof(T));
+		}
+
+		template <class T>
+		void vector(const std::vector<T>& v) {
+			static_assert(std::is_trivially_copyable_v<T>, "snapshots copy values byte by byte");
+			value((unsigned long long)v.size());
+			bytes(v.data(), v.size() * sizeof(T));
+		}
+
+	private:
+		std::vector<char>& out;
+	};
+
+	class reader {
+	public:
+		static constexpr bool loading = true;
+
+		reader(const char* data, size_t size) : p(data), end(data + size) {}
+
+		//false once anything failed to read; everything read after that is left untouched
+		bool ok() const {
+			return good;
+		}
+
+		bool done() const {
+			return good && (p == end);
+		}
+
+		void bytes(void* dst, size_t n) {
+			if (!good || ((size_t)(end - p) < n)) {
+				good = false;
+				return;
+			}
+			memcpy(dst, p, n);
+			p += n;
+		}
+
+		template <class T>
+		void value(T& v) {
+			static_assert(std::is_trivially_copyable_v<T>, "snapshots copy values byte by byte");
+			bytes(&v, sizeof(T));
+		}
+
+		template <class T>
+		void vector(std::vector<T>& v) {
+			static_assert(std::is_trivially_copyable_v<T>, "snapshots copy values byte by byte");
+			unsigned long long n = 0;
+			value(n);
+			if (!good || ((size_t)(end - p) / sizeof(T) < n)) {
+				good = false;
+				return;
+			}
+			v.resize((size_t)n);
+			bytes(v.data(), (size_t)n * sizeof(T));
+		}
+
+	private:
+		const char* p;
+		const char* end;
+		bool good = true;
+	};
+}
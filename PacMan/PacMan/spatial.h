@@ -0,0 +1,86 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+//*********************************************************************************************************************
+// 										Uniform grid for proximity queries
+//*********************************************************************************************************************
+//Entities are sorted by grid cell with a counting sort, so a rebuild is two passes over them and a query only looks
+//at the cells its circle overlaps. Positions are copied in, so the grid is a snapshot: it stays valid (and safe to
+//read from several threads) while the entities themselves move on.
+namespace spatial {
+	struct item {
+		double x, y;
+		int id;
+	};
+
+	class grid {
+	public:
+		double cell = 1; //cell size
+		int cols = 0, rows = 0;
+		std::vector<int> start; //items of cell c are items[start[c]] .. items[start[c + 1] - 1]
+		std::vector<item> items;
+
+		//covers [0,width) x [0,height); pos(i, x, y) gives entity i's position and returns false to leave it out
+		template <class F>
+		void build(double width, double height, double cell_size, int count, F pos) {
+			cell = cell_size;
+			cols = std::max(1, (int)ceil(width / cell));
+			rows = std::max(1, (int)ceil(height / cell));
+			start.assign((size_t)cols * rows + 1, 0);
+			staged.clear();
+			cells.clear();
+
+			for (int i = 0; i < count; i++) { //count entities per cell
+				item it;
+				if (!pos(i, it.x, it.y)) continue;
+				it.id = i;
+				staged.push_back(it);
+				cells.push_back(cell_of(it.x, it.y));
+				start[cells.back() + 1]++;
+			}
+			for (size_t c = 1; c < start.size(); c++) start[c] += start[c - 1]; //prefix sums: first slot of every cell
+
+			items.resize(staged.size());
+			fill.assign(start.begin(), start.end() - 1);
+			for (size_t k = 0; k < staged.size(); k++) items[fill[cells[k]]++] = staged[k]; //stable: ids stay ascending within a cell
+		}
+
+		int cell_of(double x, double y) const {
+			int cx = std::min(cols - 1, std::max(0, (int)floor(x / cell)));
+			int cy = std::min(rows - 1, std::max(0, (int)floor(y / cell)));
+			return cx + cy * cols;
+		}
+
+		//calls fn(item) for every item closer than r to (x, y); fn may return false to stop early, which keeps queries in
+		//crowds cheap. Cells are visited row by row and items in id order within a cell
+		template <class F>
+		void query(double x, double y, double r, F fn) const {
+			if (items.empty()) return;
+			int x0 = std::max(0, (int)floor((x - r) / cell)), x1 = std::min(cols - 1, (int)floor((x + r) / cell));
+			int y0 = std::max(0, (int)floor((y - r) / cell)), y1 = std::min(rows - 1, (int)floor((y + r) / cell));
+			for (int cy = y0; cy <= y1; cy++)
+				for (int cx = x0; cx <= x1; cx++)
+					for (int k = start[cx + cy * cols]; k < start[cx + cy * cols + 1]; k++) {
+						const item& it = items[k];
+						if (((it.x - x) * (it.x - x) + (it.y - y) * (it.y - y) < r * r) && !keep_going(fn, it)) return;
+					}
+		}
+
+	private:
+		//fn's result, or true when it returns nothing
+		template <class F>
+		static bool keep_going(F& fn, const item& it) {
+			if constexpr (std::is_void_v<decltype(fn(it))>) {
+				fn(it);
+				return true;
+			}
+			else return fn(it);
+		}
+
+		std::vector<item> staged; //build() scratch: items in entity order and their cells
+		std::vector<int> cells, fill;
+	};
+}